@@ -66,16 +66,12 @@ int main(int argc, const char * argv[]) {
   // Now we can interpolate the frequencies for audio time step
   double totalTime = (numFrames / double(frameRate));
   size_t numAudioFrames = ceil(totalTime * Sound::SAMPLING_RATE);
-  for (size_t t = 0; t < numAudioFrames; t ++) {
-    
-    double totalSample = 0;
-    
-    for (size_t b = 0; b < g_numBubbles; b++) {
-      totalSample += g_bubbles[b].getSample(t);
-    }
-    st.addSample(totalSample, 0);
-    st.addSample(totalSample, 1);
+  std::vector<double> mix(numAudioFrames, 0.0);
+  for (size_t b = 0; b < g_numBubbles; b++) {
+    g_bubbles[b].addSamples(&mix[0], 0, numAudioFrames);
   }
+  st.addSamples(&mix[0], numAudioFrames, 0);
+  st.addSamples(&mix[0], numAudioFrames, 1);
   
   st.normalize();
   
@@ -7,6 +7,8 @@
 //
 
 #include <iostream>
+#include <cstring>
+#include <cstdlib>
 
 #include <numeric/FastMultibubble.h>
 #include <sound/SoundFrequency.h>
@@ -45,6 +47,21 @@ int main(int argc, const char * argv[])
 {
   Fluid fluid;
   
+  // By default each bubble is solved on its own. With "--coupled d", the
+  // bubbles of a frame are solved as one system, and those closer than d
+  // interact directly (see Electrostatics::setBubbles). With "--bank", all
+  // the bubbles are rendered together by one OscillatorBank (Fluid::mixdownBank)
+  bool coupled = false;
+  bool bank = false;
+  for (int a = 1; a < argc; a++) {
+    if (!strcmp(argv[a], "--coupled") && a + 1 < argc) {
+      coupled = true;
+      fluid.setBubbleCouplingDistance(atof(argv[++a]));
+    } else if (!strcmp(argv[a], "--bank")) {
+      bank = true;
+    }
+  }
+  
   SoundTrack st;
   SoundFileManager sfm("/Users/phaedon/fabbubbles5.aiff");
   
@@ -66,6 +83,10 @@ int main(int argc, const char * argv[])
     
     fluid.setFluidDomain(&airMesh, &solidMesh);
 
+    // The bubbles present in this frame, when they are solved together
+    std::vector<TriangleMesh *> frameBubbles;
+    std::vector<size_t> frameBubbleIndices;
+    std::vector<std::string> fastBEMfiles, velocityFiles;
     
     for (size_t b = 0; b < numBubbles; b++) {
       //std::string zeroBubNum = ZeroPadNumber(b, ZPADLEN);
@@ -79,11 +100,24 @@ int main(int argc, const char * argv[])
         bubbleMeshes[b].flipNormals();
         std::string fastBEMfile = fastBEMFilename(baseDir, "fastbem", b, i);
         std::string velocityFile = velocityFilename(baseDir, "velocities", b, i);
-        fluid.setBubble(&bubbleMeshes[b], b, timeStamp, fastBEMfile, velocityFile);
+        
+        if (!coupled) {
+          fluid.setBubble(&bubbleMeshes[b], b, timeStamp, fastBEMfile, velocityFile);
+          continue;
+        }
+        
+        frameBubbles.push_back(&bubbleMeshes[b]);
+        frameBubbleIndices.push_back(b);
+        fastBEMfiles.push_back(fastBEMfile);
+        velocityFiles.push_back(velocityFile);
       }
       
       
     }
+    
+    if (coupled) {
+      fluid.setBubbles(frameBubbles, frameBubbleIndices, timeStamp, fastBEMfiles, velocityFiles);
+    }
   }
   
   for (size_t b = 0; b < numBubbles; b++) {
@@ -91,21 +125,16 @@ int main(int argc, const char * argv[])
   }
   
   //fluid.printAllFrequencies();
-  fluid.integrateAllBubbleSounds();
-  
   
   // Now we can interpolate the frequencies for audio time step
   double totalTime = (numFrames / double(frameRate));
   size_t numAudioFrames = ceil(totalTime * Sound::SAMPLING_RATE);
-  for (size_t t = 0; t < numAudioFrames; t ++) {
-
-    double totalSample = 0;
-    
-    for (size_t b = 0; b < numBubbles; b++) {
-      totalSample += fluid.getSample(b, t);
-    }
-    st.addSample(totalSample, 0);
-    st.addSample(totalSample, 1);
+  
+  if (bank) {
+    fluid.mixdownBank(st, numAudioFrames);
+  } else {
+    fluid.integrateAllBubbleSounds();
+    fluid.mixdown(st, numAudioFrames);
   }
   
   st.normalize();
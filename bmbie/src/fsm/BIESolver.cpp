@@ -69,3 +69,32 @@ std::complex<REAL> BIESolver::eval(const Point3<REAL>& pt) const
   return complex<REAL>(0., 0.);
 }
 
+
+/*
+ * With A P = Q R, A^T = P R^T Q^T and A^H = P R^H Q^H. So a transposed
+ * (adjoint) solve is a permutation, a triangular solve with R^T (R^H), and
+ * the application of conj(Q) (Q).
+ */
+void BIESolver::solve_transposed(const TMatrixXc& rhs, TMatrixXc& X) const
+{
+    const Eigen::Index n = (Eigen::Index)nEles_;
+
+    X = qr_.colsPermutation().transpose() * rhs;
+    qr_.matrixR().topLeftCorner(n, n).triangularView<Eigen::Upper>()
+            .transpose().solveInPlace(X);
+
+    // conj(Q) z = conj(Q conj(z))
+    X = X.conjugate();
+    X.applyOnTheLeft(qr_.householderQ());
+    X = X.conjugate();
+}
+
+void BIESolver::solve_adjoint(const TMatrixXc& rhs, TMatrixXc& X) const
+{
+    const Eigen::Index n = (Eigen::Index)nEles_;
+
+    X = qr_.colsPermutation().transpose() * rhs;
+    qr_.matrixR().topLeftCorner(n, n).triangularView<Eigen::Upper>()
+            .adjoint().solveInPlace(X);
+    X.applyOnTheLeft(qr_.householderQ());
+}
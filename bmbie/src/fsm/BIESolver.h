@@ -16,7 +16,8 @@ class BIESolver
                 spec_(spec),
                 nEles_( spec->triangles.size() ),
                 crho_( spec->speed * spec->density ),
-                crhoInv4PI_( spec->speed * spec->density / (4.*M_PI) )
+                crhoInv4PI_( spec->speed * spec->density / (4.*M_PI) ),
+                qr_(nEles_, nEles_)
         {
             A_.resize( nEles_, nEles_ );
             B_.resize( nEles_, nEles_ );
@@ -33,6 +34,15 @@ class BIESolver
         /* evaluate pressure value using the BI formula */
         std::complex<REAL> eval(const Point3<REAL>& pt) const;
 
+        /*
+         * Solve A^T X = rhs (A^H X = rhs for solve_adjoint), one column of
+         * rhs per right-hand side, reusing the QR factorization of A from
+         * the last solve. This is O(n^2) per column, where forming A^{-1}
+         * would be O(n^3).
+         */
+        void solve_transposed(const TMatrixXc& rhs, TMatrixXc& X) const;
+        void solve_adjoint(const TMatrixXc& rhs, TMatrixXc& X) const;
+
     protected:
         const BIESpec*                      spec_;
         size_t                              nEles_;
@@ -43,6 +53,7 @@ class BIESolver
         REAL                                k_, invK_;  // wave number
         TMatrixXc                           A_, B_;
         TVectorXc                           b_, x_;     // x_ store the solution (i.e., the pressure on elements)
+        Eigen::ColPivHouseholderQR<TMatrixXc>   qr_;    // A P = Q R
 };
 
 #endif
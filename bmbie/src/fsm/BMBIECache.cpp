@@ -0,0 +1,87 @@
+#include "BMBIECache.h"
+#include <algorithm>
+#include <tbb/parallel_for.h>
+
+using namespace std;
+
+struct _ParallelBMBIECacheFill
+{
+    const BIESpec*  spec_;
+    REAL*           data_;
+    size_t          stride_;
+
+    _ParallelBMBIECacheFill(const BIESpec* s, REAL* d, size_t stride):
+            spec_(s), data_(d), stride_(stride) { }
+
+    void operator() (const tbb::blocked_range<size_t>& r) const
+    {
+        for(size_t ii = r.begin();ii != r.end();++ ii)
+            BMBIEGeometryCache::fill_row(spec_, ii, data_ + ii*stride_);
+    }
+};
+
+BMBIEGeometryCache::BMBIEGeometryCache(const BIESpec* spec, size_t maxBytes):
+        spec_(spec), rowSize_(spec->triangles.size() * spec->nGaussPts)
+{
+    nRows_ = min(spec->triangles.size(), maxBytes / row_bytes(spec));
+    data_.resize(nRows_ * NUM_COEFFS * rowSize_);
+
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, nRows_),
+                      _ParallelBMBIECacheFill(spec, data_.data(), NUM_COEFFS*rowSize_));
+}
+
+void BMBIEGeometryCache::fill_row(const BIESpec* spec, size_t rowId, REAL* out)
+{
+    const size_t nEles = spec->triangles.size();
+    const size_t nGauss = spec->nGaussPts;
+    const size_t rowSize = nEles * nGauss;
+    const REAL   crho = spec->speed * spec->density;
+
+    REAL* R  = out + BMBIEGeometryCache::R *rowSize;
+    REAL* L0 = out + BMBIEGeometryCache::L0*rowSize;
+    REAL* L1 = out + BMBIEGeometryCache::L1*rowSize;
+    REAL* L2 = out + BMBIEGeometryCache::L2*rowSize;
+    REAL* P1 = out + BMBIEGeometryCache::P1*rowSize;
+    REAL* P2 = out + BMBIEGeometryCache::P2*rowSize;
+
+    const Vector3<REAL>& nx = spec->triNormals[rowId];
+
+    for(size_t cId = 0;cId < nEles;++ cId)
+    {
+        const Vector3<REAL>& ny = spec->triNormals[cId];
+        const REAL nxdotny = nx.dot(ny);
+
+        for(size_t gi = 0, id = cId*nGauss;gi < nGauss;++ gi, ++ id)
+        {
+            if ( cId == rowId )
+            {   // the diagonal is integrated separately (construct_R)
+                R[id] = L0[id] = L1[id] = L2[id] = P1[id] = P2[id] = 0;
+                continue;
+            }
+
+            // gaussian point --> tri[rId] center
+            Vector3<REAL> r = spec->triCenters[rowId] - spec->gaussPts[cId][gi];
+            const REAL lenr  = r.length();
+            const REAL lenr2 = r.length_sqr();
+            const REAL w     = spec->gaussWeights[cId][gi];
+            const REAL invss = 1. / (4.*M_PI*lenr2*lenr);
+            const REAL rdotny = r.dot(ny);
+            const REAL rdotnx = r.dot(nx);
+            const REAL rnn    = rdotny * rdotnx;
+
+            const REAL S = w * crho / (4.*M_PI*lenr);   // single layer
+            const REAL D = -w * rdotny * invss;         // double layer
+            const REAL M = w * rdotnx * invss * crho;   // adjoint double layer
+            const REAL H = w * invss;                   // hypersingular
+
+            R[id]  = lenr;
+            /* (-1+ikr) D + ((-3/r + (k-3/(r*r*k))i) rnn + (r + i/k) nxdotny) H */
+            L0[id] = -D + H*(lenr*nxdotny - 3.*rnn/lenr);
+            L1[id] = lenr*D + H*rnn;
+            L2[id] = H*(nxdotny - 3.*rnn/lenr2);
+            /* ik S + ik (-r-i/k) M */
+            P1[id] = M;
+            P2[id] = S - lenr*M;
+        }
+    }
+}
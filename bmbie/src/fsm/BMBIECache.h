@@ -0,0 +1,61 @@
+#ifndef BM_BIE_CACHE_INC
+#   define BM_BIE_CACHE_INC
+
+#include <vector>
+#include "BIESpec.h"
+
+/*
+ * The frequency-independent part of the Burton-Miller off-diagonal terms.
+ *
+ * For a row (collocation point x at a triangle center) and a column's
+ * Gaussian point y, with r = x - y, the two entries accumulate
+ *
+ *      A(x,y) += e^{ikr} (L0 + i (k L1 + L2 / k))
+ *      B(x,y) += e^{ikr} (P1 + i k P2)
+ *
+ * where L0, L1, L2, P1, P2 only depend on the geometry (|r|, r.n_x, r.n_y,
+ * n_x.n_y and the quadrature weight). They are computed once for a sweep,
+ * so the assembly at each frequency is one complex exponential and two
+ * complex multiply-adds per Gaussian point.
+ *
+ * The coefficients of a row are stored as six contiguous arrays (structure
+ * of arrays) indexed by col*nGaussPts + gi. When not all rows fit in the
+ * memory budget, the first ones are cached and the others are filled into
+ * a scratch buffer (fill_row) whenever they are needed.
+ */
+class BMBIEGeometryCache
+{
+    public:
+        enum { R = 0, L0, L1, L2, P1, P2, NUM_COEFFS };
+
+        /* caches as many rows as fit in maxBytes */
+        BMBIEGeometryCache(const BIESpec* spec, size_t maxBytes);
+
+        /* memory (in bytes) for the coefficients of one row */
+        static size_t row_bytes(const BIESpec* spec)
+        {   return NUM_COEFFS * spec->triangles.size() * spec->nGaussPts * sizeof(REAL); }
+
+        size_t num_cached_rows() const
+        {   return nRows_; }
+
+        size_t memory() const
+        {   return data_.size() * sizeof(REAL); }
+
+        /*
+         * The coefficients of a row, coefficient q (R, L0, ...) at
+         * q*nEles*nGaussPts, or NULL if the row is not cached
+         */
+        const REAL* row(size_t rowId) const
+        {   return rowId < nRows_ ? &data_[rowId*NUM_COEFFS*rowSize_] : NULL; }
+
+        /* computes the coefficients of one row into out, laid out as above */
+        static void fill_row(const BIESpec* spec, size_t rowId, REAL* out);
+
+    private:
+        const BIESpec*      spec_;
+        size_t              rowSize_;   // nEles * nGaussPts
+        size_t              nRows_;
+        std::vector<REAL>   data_;
+};
+
+#endif
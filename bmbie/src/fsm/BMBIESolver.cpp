@@ -1,6 +1,7 @@
 #include "BMBIESolver.h"
 #include <tbb/parallel_for.h>
 #include "utils/term_msg.h"
+#include "utils/cis.hpp"
 
 using namespace std;
 
@@ -47,10 +48,29 @@ struct _ParallelBMBIEConstruct
   
   void operator() (const tbb::blocked_range<size_t>& r) const
   {
-    for(size_t ii = r.begin();ii != r.end();++ ii) construct_row(ii);
+    const BMBIEGeometryCache* cache = s_->cache_;
+    
+    // rows that are not in the cache are computed into here
+    std::vector<REAL> scratch;
+    // k*r, cos(k*r) and sin(k*r) of all the Gaussian points of a row
+    std::vector<REAL> phase(3 * s_->nEles_ * spec_->nGaussPts);
+    
+    for(size_t ii = r.begin();ii != r.end();++ ii)
+    {
+      if ( cache && cache->row(ii) )
+      {
+        construct_row(ii, cache->row(ii), phase.data());
+      }
+      else
+      {
+        scratch.resize(BMBIEGeometryCache::row_bytes(spec_) / sizeof(REAL));
+        BMBIEGeometryCache::fill_row(spec_, ii, scratch.data());
+        construct_row(ii, scratch.data(), phase.data());
+      }
+    }
   }
   
-  void construct_row(size_t rowId) const
+  void construct_row(size_t rowId, const REAL* coeffs, REAL* phase) const
   {
     /*
      * the 1/2 will be canceled by +beta* ik/2 if we choose beta = i/k
@@ -62,13 +82,45 @@ struct _ParallelBMBIEConstruct
      */
     s_->B_(rowId,rowId) = complex<REAL>(0,0);
     
+    const size_t nGauss  = spec_->nGaussPts;
+    const size_t rowSize = s_->nEles_ * nGauss;
+    const REAL* R  = coeffs + BMBIEGeometryCache::R *rowSize;
+    const REAL* L0 = coeffs + BMBIEGeometryCache::L0*rowSize;
+    const REAL* L1 = coeffs + BMBIEGeometryCache::L1*rowSize;
+    const REAL* L2 = coeffs + BMBIEGeometryCache::L2*rowSize;
+    const REAL* P1 = coeffs + BMBIEGeometryCache::P1*rowSize;
+    const REAL* P2 = coeffs + BMBIEGeometryCache::P2*rowSize;
+    
+    const REAL k = s_->k_;
+    const REAL invK = 1. / k;
+    
+    //// e^{ikr} of the whole row at once (see utils/cis.hpp)
+    REAL* kr   = phase;
+    REAL* cosv = phase + rowSize;
+    REAL* sinv = phase + 2*rowSize;
+    for(size_t id = 0;id < rowSize;++ id) kr[id] = k * R[id];
+    cis_batch(kr, cosv, sinv, rowSize);
+    
     for(size_t cId = 0;cId < s_->nEles_;++ cId)
     {
       if ( cId == rowId ) continue;
       //// triangle[rowId] <----- triangle[cId]
-      //// construct S matrix:   S q(y) = \int G q dS(y)
-      //// construct D matrix
-      construct_SD(rowId, cId);   // only affect the off-diagonal terms
+      //// S, D, M and H parts together (see BMBIECache.h)
+      REAL leftRe = 0, leftIm = 0;
+      REAL rightRe = 0, rightIm = 0;
+      
+      for(size_t gi = 0, id = cId*nGauss;gi < nGauss;++ gi, ++ id)
+      {
+        const REAL lIm = k*L1[id] + L2[id]*invK;
+        const REAL rIm = k*P2[id];
+        leftRe  += cosv[id]*L0[id] - sinv[id]*lIm;
+        leftIm  += cosv[id]*lIm    + sinv[id]*L0[id];
+        rightRe += cosv[id]*P1[id] - sinv[id]*rIm;
+        rightIm += cosv[id]*rIm    + sinv[id]*P1[id];
+      }
+      
+      s_->B_(rowId,cId) = complex<REAL>(rightRe, rightIm);
+      s_->A_(rowId,cId) = complex<REAL>(leftRe, leftIm);
     }
     construct_R(rowId);
   }
@@ -93,49 +145,6 @@ struct _ParallelBMBIEConstruct
     s_->B_(rId,rId) -= sum1 * i4pik * complex<REAL>(0, s_->k_)* s_->crho_;  // *ik*rho*c
     s_->A_(rId,rId) -= sum2 * i4pik;
   }
-  
-  void construct_SD(size_t rId, size_t cId) const
-  {
-    const BIESpec*  spec = spec_;
-    
-    complex<REAL> rightij(0,0);
-    complex<REAL> leftij(0,0);
-    const complex<REAL> ik = complex<REAL>(0,s_->k_);
-    
-    for(size_t gi = 0;gi < spec->nGaussPts;++ gi)
-    {
-      // gaussian point --> tri[rId] center
-      Vector3<REAL> r = spec->triCenters[rId] - spec->gaussPts[cId][gi];
-      const REAL lenr  = r.length();
-      const REAL lenr2 = r.length_sqr();                              // r^2
-      const complex<REAL> expikr = std::exp(complex<REAL>(0,s_->k_*lenr));
-      
-      const complex<REAL> cacheS = spec->gaussWeights[cId][gi]*
-      s_->crho_ / (4.*M_PI*lenr);                 // independent of k
-      /* ik*c*rho*exp(ikr)/(4*PI*r) */
-      rightij += ik*expikr*cacheS;  //std::exp(complex<REAL>(0,s_->k_*lenr))*
-      
-      const REAL invss = 1. / (4.*M_PI*lenr2*lenr);
-      const REAL rdotny = r.dot(spec->triNormals[cId]);
-      const REAL rdotnx = r.dot(spec->triNormals[rId]);
-      const complex<REAL> cacheD = -spec->gaussWeights[cId][gi] * rdotny * invss;
-      const complex<REAL> cacheM =  spec->gaussWeights[cId][gi] * rdotnx * invss * s_->crho_;
-      /* (-1+ikr)*exp(ikr)*-<r.n>/(4*PI*r^3) */
-      leftij  += complex<REAL>(-1,s_->k_*lenr) * expikr * cacheD;
-      /* (-r-i/k)*exp(ikr)*<r.n>/(4*PI*r^3)*rho*c*ik */
-      rightij += ik*complex<REAL>(-lenr,-1./s_->k_) * expikr * cacheM;
-      
-      /* ---- H matrix part ---- */
-      complex<REAL> v1(-3./lenr, s_->k_ - 3./(lenr2*s_->k_));   // -3/r + (k-3/(r*r*k))i
-      v1 *= (rdotny*rdotnx);
-      complex<REAL> v2(lenr, 1./s_->k_);                        // r - i/k
-      v2 *= spec->triNormals[cId].dot(spec->triNormals[rId]);
-      leftij += (v1+v2)*expikr * (invss * spec->gaussWeights[cId][gi]);
-    }
-    
-    s_->B_(rId,cId) = rightij;
-    s_->A_(rId,cId) = leftij;
-  }
 };
 
 void BMBIESolver::solve(REAL freq)
@@ -157,57 +166,58 @@ void BMBIESolver::solve(REAL freq)
 
 
 
-void BMBIESolver::computeWeightVector(const Vector3<REAL> & x,
-                                      Eigen::VectorXcd &wts) {
-  
-  Eigen::VectorXcd lp;
-  Eigen::VectorXcd lv;
+/*
+ * For listener x and triangle i (center y, normal n, area a), with
+ * r = y - x and e^{ikr} = c + i s:
+ *
+ *      lp(i) = a conj(grad G) . n = a (r.n) / (4 pi r^3) (1 - ikr) e^{ikr}
+ *      lv(i) = a G                = -a / (4 pi r) e^{-ikr}
+ *
+ * The phases of all the (triangle, listener) pairs go through one
+ * cis_batch call; the rest is real arithmetic.
+ */
+void BMBIESolver::computeWeightMatrix(const std::vector< Vector3<REAL> >& ears,
+                                      TMatrixXc& wts) {
   
-  size_t nTris = spec_->triangles.size();
+  const size_t nTris = spec_->triangles.size();
+  const size_t nEars = ears.size();
+  const size_t nPairs = nTris * nEars;
   
-  lp.resize(nTris);
-  lv.resize(nTris);
-  wts.resize(nTris);
+  TMatrixXc lp(nTris, nEars);
+  TMatrixXc lv(nTris, nEars);
   
-  for (size_t i = 0; i < nTris; i++) {
-    Vector3<REAL> y = spec_->triCenters[i];
-    Vector3<REAL> r = y - x; // TODO maybe switch?
-    
-    Eigen::Vector3cd rc(complex<REAL>(r.x, 0),
-                               complex<REAL>(r.y, 0),
-                               complex<REAL>(r.z, 0));
-    
-    const REAL lenr  = r.length();
-    const REAL lenr2 = r.length_sqr();
-    
-    const complex<REAL> ikr(0, k_ * lenr);
-    const complex<REAL> ikr_plus_1(1, k_ * lenr);
-    const complex<REAL> negikr(0, -k_ * lenr);
-
-    const complex<REAL> expikr = std::exp(ikr);
-    const complex<REAL> expnegikr = std::exp(negikr);
-    
-    const REAL invss = 1. / (4.*M_PI*lenr2*lenr);
-    
-    const complex<REAL> G = -expnegikr / (4.0 * M_PI * lenr);
-    const Eigen::Vector3cd GradG = (ikr_plus_1 * expnegikr / (4.0 * M_PI * lenr * lenr2)) * rc;
-    const Eigen::Vector3cd GradGReal(GradG.x().real(), GradG.y().real(), GradG.z().real());
-    const Eigen::Vector3cd complexNormal(complex<REAL>(spec_->triNormals[i].x, 0),
-                                         complex<REAL>(spec_->triNormals[i].y, 0),
-                                         complex<REAL>(spec_->triNormals[i].z, 0));
-                                      
-   // const REAL dGdn_r = GradGReal.dot(spec_->triNormals[i]);
-    const complex<REAL> dGdn_c = GradG.dot(complexNormal);
-    lp(i) = spec_->triAreas[i] * dGdn_c;
-    lv(i) = spec_->triAreas[i] * G ;
-    
-  }
+  // |r|, then k|r|, cos(k|r|) and sin(k|r|) of every pair, ear-major
+  std::vector<REAL> lenr(nPairs), kr(nPairs), cosv(nPairs), sinv(nPairs);
+  for (size_t e = 0, id = 0; e < nEars; e++)
+    for (size_t i = 0; i < nTris; i++, id++) {
+      lenr[id] = (spec_->triCenters[i] - ears[e]).length();
+      kr[id] = k_ * lenr[id];
+    }
+  cis_batch(kr.data(), cosv.data(), sinv.data(), nPairs);
   
+  for (size_t e = 0, id = 0; e < nEars; e++)
+    for (size_t i = 0; i < nTris; i++, id++) {
+      const Vector3<REAL> r = spec_->triCenters[i] - ears[e];
+      const REAL a = spec_->triAreas[i];
+      const REAL lr = lenr[id];
+      
+      const REAL dGdn = a * r.dot(spec_->triNormals[i]) / (4.*M_PI*lr*lr*lr);
+      lp(i,e) = complex<REAL>(dGdn * (cosv[id] + kr[id]*sinv[id]),
+                              dGdn * (sinv[id] - kr[id]*cosv[id]));
+      
+      const REAL G = -a / (4.*M_PI*lr);
+      lv(i,e) = complex<REAL>(G * cosv[id], -G * sinv[id]);
+    }
   
-  // Equation (41) from Doug James, Fast Multibubble writeup
-  std::cout << "lp dim: " << lp.rows() << " x " << lp.cols() << std::endl;
-  std::cout << "lv dim: " << lv.rows() << " x " << lv.cols() << std::endl;
-  std::cout << "A dim: " << A_.rows() << " x " << A_.cols() << std::endl;
+  // Equation (41) from Doug James, Fast Multibubble writeup:
+  // wts = (lp^T A^{-1} + lv^T)^T = A^{-T} lp + lv, all ears in one solve
+  solve_transposed(lp, wts);
+  wts += lv;
+}
 
-  wts = (lp.transpose() * A_.inverse() + lv.transpose()).transpose();
+void BMBIESolver::computeWeightVector(const Vector3<REAL> & x,
+                                      Eigen::VectorXcd &wts) {
+  TMatrixXc w;
+  computeWeightMatrix(std::vector< Vector3<REAL> >(1, x), w);
+  wts = w.col(0);
 }
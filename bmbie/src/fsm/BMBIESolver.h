@@ -3,7 +3,9 @@
 
 #include <boost/multi_array.hpp>
 #include "BIESolver.h"
+#include "BMBIECache.h"
 #include <complex>
+#include <vector>
 
 /*
  * Helmholtz BIE solver using Burton-Miller formula
@@ -13,19 +15,33 @@ class BMBIESolver : public BIESolver
   friend struct _ParallelBMBIEConstruct;
   
 public:
-  BMBIESolver(const BIESpec* spec):BIESolver(spec), qr_(nEles_, nEles_)
+  BMBIESolver(const BIESpec* spec):BIESolver(spec), cache_(NULL)
   { }
   
+  /*
+   * Takes the frequency-independent coefficients from cache (shared, not
+   * owned) rather than computing them at every solve. NULL goes back to
+   * computing them.
+   */
+  void use_cache(const BMBIEGeometryCache* cache)
+  {   cache_ = cache; }
+  
   void solve(REAL freq);
   
   
   void computeWeightVector(const Vector3<REAL> &x, // listening position
                            Eigen::VectorXcd &wts);
   
+  /*
+   * The weights of several listening positions at once, one column of
+   * wts per position, solved together as a multi-RHS system
+   */
+  void computeWeightMatrix(const std::vector< Vector3<REAL> > &ears,
+                           TMatrixXc &wts);
+  
   
 private:
-  Eigen::ColPivHouseholderQR<TMatrixXc> qr_;
-  //Eigen::FullPivLU<TMatrixXc> qr_;
+  const BMBIEGeometryCache* cache_;
 };
 
 #endif
@@ -0,0 +1,112 @@
+#include "CBIECache.h"
+#include <algorithm>
+#include <string>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "utils/term_msg.h"
+
+using namespace std;
+
+CBIEDerivCache::CBIEDerivCache(const BIESpec* spec, size_t maxBytes, size_t maxDiskBytes,
+                               const char* spillDir, size_t rowsPerTile):
+        spec_(spec), rowSize_(spec->triangles.size() * spec->nGaussPts),
+        nMemRows_(0), nDiskRows_(0), mapped_(NULL), mappedBytes_(0)
+{
+    const size_t nEles = spec->triangles.size();
+    const size_t rowBytes = row_bytes(spec);
+
+    rowsPerTile_ = rowsPerTile ? rowsPerTile :
+            max((size_t)1, (size_t)CBIE_CACHE_TILE_BYTES / rowBytes);
+    rowsPerTile_ = min(rowsPerTile_, max((size_t)1, nEles));
+
+    const size_t tileBytes = rowsPerTile_ * rowBytes;
+    const size_t nTiles = (nEles + rowsPerTile_ - 1) / rowsPerTile_;
+    const size_t nMemTiles  = min(nTiles, maxBytes / tileBytes);
+    size_t nDiskTiles = min(nTiles - nMemTiles, maxDiskBytes / tileBytes);
+
+    memory_.resize(nMemTiles * tileBytes / sizeof(REAL));
+    if ( nDiskTiles ) map_spill_file(spillDir, nDiskTiles * tileBytes);
+    if ( !mapped_ ) nDiskTiles = 0;
+
+    tiles_.assign(nTiles, (REAL*)NULL);
+    for(size_t i = 0;i < nMemTiles;++ i)
+        tiles_[i] = &memory_[i * tileBytes / sizeof(REAL)];
+    for(size_t i = 0;i < nDiskTiles;++ i)
+        tiles_[nMemTiles + i] = (REAL*)mapped_ + i * tileBytes / sizeof(REAL);
+
+    // the last tile may be partial
+    nMemRows_  = min(nEles, nMemTiles * rowsPerTile_);
+    nDiskRows_ = min(nEles - nMemRows_, nDiskTiles * rowsPerTile_);
+}
+
+CBIEDerivCache::~CBIEDerivCache()
+{
+    if ( mapped_ ) munmap(mapped_, mappedBytes_);
+}
+
+/*
+ * The spill file is unlinked as soon as it is mapped, so it goes away with
+ * the process however that ends. On failure the tiles are recomputed.
+ */
+void CBIEDerivCache::map_spill_file(const char* spillDir, size_t bytes)
+{
+    if ( !spillDir ) spillDir = getenv("TMPDIR");
+    if ( !spillDir ) spillDir = "/tmp";
+
+    string path = string(spillDir) + "/cbie-cache-XXXXXX";
+    int fd = mkstemp(&path[0]);
+    if ( fd < 0 )
+    {
+        PRINT_WARNING("Cannot create the cache file in %s, recomputing instead\n", spillDir);
+        return;
+    }
+    unlink(path.c_str());
+
+    if ( ftruncate(fd, (off_t)bytes) == 0 )
+    {
+        void* p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if ( p != MAP_FAILED )
+        {
+            mapped_ = p;
+            mappedBytes_ = bytes;
+        }
+    }
+    close(fd);
+
+    if ( !mapped_ )
+        PRINT_WARNING("Cannot map %.1f MB of cache file, recomputing instead\n",
+                      (double)bytes / (1024.*1024.));
+}
+
+void CBIEDerivCache::fill_row(const BIESpec* spec, size_t rowId, REAL* out)
+{
+    const size_t nEles = spec->triangles.size();
+    const size_t nGauss = spec->nGaussPts;
+    const size_t rowSize = nEles * nGauss;
+    const REAL   crho = spec->speed * spec->density;
+
+    REAL* R = out + CBIEDerivCache::R*rowSize;
+    REAL* S = out + CBIEDerivCache::S*rowSize;
+    REAL* D = out + CBIEDerivCache::D*rowSize;
+
+    for(size_t cId = 0;cId < nEles;++ cId)
+    for(size_t gi = 0, id = cId*nGauss;gi < nGauss;++ gi, ++ id)
+    {
+        if ( cId == rowId )
+        {   // the diagonal is integrated separately (construct_R)
+            R[id] = S[id] = D[id] = 0;
+            continue;
+        }
+
+        // gaussian point --> tri[rId] center
+        Vector3<REAL> r = spec->triCenters[rowId] - spec->gaussPts[cId][gi];
+        const REAL lenr  = r.length();
+        const REAL lenr2 = lenr*lenr;                                   // r^2
+        const REAL w     = spec->gaussWeights[cId][gi];
+
+        R[id] = lenr;
+        S[id] = w * crho / (4.*M_PI*lenr);
+        D[id] = -w * r.dot(spec->triNormals[cId]) / (4.*M_PI*lenr2*lenr);
+    }
+}
@@ -0,0 +1,90 @@
+#ifndef CBIE_CACHE_INC
+#   define CBIE_CACHE_INC
+
+#include <vector>
+#include "BIESpec.h"
+
+/* default size of a tile of rows */
+#define CBIE_CACHE_TILE_BYTES   (4 << 20)
+
+/*
+ * The frequency-independent part of the CBIE off-diagonal terms.
+ *
+ * For a row (collocation point x at a triangle center) and a column's
+ * Gaussian point y, with r = x - y, the two entries accumulate
+ *
+ *      B(x,y) += ik e^{ikr} S,        S = w c rho / (4 pi |r|)
+ *      A(x,y) += (-1+ikr) e^{ikr} D,  D = -w (r.n_y) / (4 pi |r|^3)
+ *
+ * The coefficients |r|, S and D of a row are stored as three contiguous
+ * arrays indexed by col*nGaussPts + gi. At 3 n^2 nGaussPts values the
+ * whole table is far too large for big meshes, so it is split into tiles
+ * of consecutive rows, and each tile lives
+ *
+ *  - in memory, while the tiles fit in maxBytes;
+ *  - in a temporary file mapped into memory, while they fit in
+ *    maxDiskBytes more;
+ *  - nowhere: its rows are recomputed (fill_row) whenever they are needed.
+ *
+ * The stored tiles are filled by the first assembly that uses them
+ * (fill_row into row()) and only read by the later ones.
+ */
+class CBIEDerivCache
+{
+    public:
+        enum { R = 0, S, D, NUM_COEFFS };
+
+        /*
+         * rowsPerTile = 0 picks tiles of about CBIE_CACHE_TILE_BYTES; the
+         * spill file goes into spillDir (NULL: $TMPDIR or /tmp)
+         */
+        CBIEDerivCache(const BIESpec* spec, size_t maxBytes, size_t maxDiskBytes = 0,
+                       const char* spillDir = NULL, size_t rowsPerTile = 0);
+        ~CBIEDerivCache();
+
+        /* memory (in bytes) for the coefficients of one row */
+        static size_t row_bytes(const BIESpec* spec)
+        {   return NUM_COEFFS * spec->triangles.size() * spec->nGaussPts * sizeof(REAL); }
+
+        size_t rows_per_tile() const
+        {   return rowsPerTile_; }
+
+        size_t num_tiles() const
+        {   return tiles_.size(); }
+
+        size_t num_memory_rows() const
+        {   return nMemRows_; }
+
+        size_t num_disk_rows() const
+        {   return nDiskRows_; }
+
+        /*
+         * Where the coefficients of a row are stored, coefficient q (R, S, D)
+         * at q*nEles*nGaussPts, or NULL if the row is recomputed
+         */
+        REAL* row(size_t rowId) const
+        {
+            REAL* tile = tiles_[rowId / rowsPerTile_];
+            return tile ? tile + (rowId % rowsPerTile_)*NUM_COEFFS*rowSize_ : NULL;
+        }
+
+        /* computes the coefficients of one row into out, laid out as above */
+        static void fill_row(const BIESpec* spec, size_t rowId, REAL* out);
+
+    private:
+        void map_spill_file(const char* spillDir, size_t bytes);
+
+    private:
+        const BIESpec*      spec_;
+        size_t              rowSize_;       // nEles * nGaussPts
+        size_t              rowsPerTile_;
+        size_t              nMemRows_;
+        size_t              nDiskRows_;
+
+        std::vector<REAL*>  tiles_;         // NULL: recomputed
+        std::vector<REAL>   memory_;
+        void*               mapped_;        // the spill file, unlinked
+        size_t              mappedBytes_;
+};
+
+#endif
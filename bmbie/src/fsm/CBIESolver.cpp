@@ -1,14 +1,14 @@
 #include "CBIESolver.h"
 #include <tbb/parallel_for.h>
 #include "utils/term_msg.h"
+#include "utils/cis.hpp"
 
 using namespace std;
 
-CBIESolver::CBIESolver(const BIESpec* spec):
+CBIESolver::CBIESolver(const BIESpec* spec, size_t maxCacheBytes,
+                       size_t maxDiskBytes, const char* spillDir):
         BIESolver(spec), cached_(false),
-        derCacheD_(boost::extents[ spec->triangles.size() ][ spec->triangles.size() ][ spec->nGaussPts ]),
-        derCacheS_(boost::extents[ spec->triangles.size() ][ spec->triangles.size() ][ spec->nGaussPts ]),
-        qr_(nEles_, nEles_)
+        derCache_(spec, maxCacheBytes, maxDiskBytes, spillDir)
 { }
 
 /*
@@ -23,21 +23,69 @@ struct _ParallelCBIEConstruct
 
     void operator() (const tbb::blocked_range<size_t>& r) const
     {
-        for(size_t ii = r.begin();ii != r.end();++ ii) construct_row(ii);
+        const size_t rowSize = s_->nEles_ * spec_->nGaussPts;
+
+        // rows that are not stored in the cache are computed into here
+        std::vector<REAL> scratch;
+        // k*r, cos(k*r) and sin(k*r) of all the Gaussian points of a row
+        std::vector<REAL> phase(3 * rowSize);
+
+        for(size_t ii = r.begin();ii != r.end();++ ii)
+        {
+            REAL* coeffs = s_->derCache_.row(ii);
+            if ( !coeffs )
+            {
+                scratch.resize(CBIEDerivCache::row_bytes(spec_) / sizeof(REAL));
+                coeffs = scratch.data();
+                CBIEDerivCache::fill_row(spec_, ii, coeffs);
+            }
+            else if ( !s_->cached_ )
+            {   // first solve: fill the cache as we go
+                CBIEDerivCache::fill_row(spec_, ii, coeffs);
+            }
+            construct_row(ii, coeffs, phase.data());
+        }
     }
 
-    void construct_row(size_t rowId) const
+    void construct_row(size_t rowId, const REAL* coeffs, REAL* phase) const
     {
         s_->A_(rowId,rowId) = complex<REAL>(0.5,0);
         s_->B_(rowId,rowId) = complex<REAL>(-0.5,0)*s_->crho_; // i/(2k) * ik * rho*c
 
+        const size_t nGauss  = spec_->nGaussPts;
+        const size_t rowSize = s_->nEles_ * nGauss;
+        const REAL* R = coeffs + CBIEDerivCache::R*rowSize;
+        const REAL* S = coeffs + CBIEDerivCache::S*rowSize;
+        const REAL* D = coeffs + CBIEDerivCache::D*rowSize;
+
+        const REAL k = s_->k_;
+
+        //// e^{ikr} of the whole row at once (see utils/cis.hpp)
+        REAL* kr   = phase;
+        REAL* cosv = phase + rowSize;
+        REAL* sinv = phase + 2*rowSize;
+        for(size_t id = 0;id < rowSize;++ id) kr[id] = k * R[id];
+        cis_batch(kr, cosv, sinv, rowSize);
+
         for(size_t cId = 0;cId < s_->nEles_;++ cId)
         {
             if ( cId == rowId ) continue;
             //// triangle[rowId] <----- triangle[cId]
-            //// construct S matrix:   S q(y) = \int G q dS(y)
-            //// construct D matrix
-            construct_SD(rowId, cId);
+            //// S matrix:  ik*c*rho*exp(ikr)/(4*PI*r)
+            //// D matrix:  (-1+ikr)*exp(ikr)*-<r.n>/(4*PI*r^3)
+            REAL sRe = 0, sIm = 0;
+            REAL dRe = 0, dIm = 0;
+
+            for(size_t gi = 0, id = cId*nGauss;gi < nGauss;++ gi, ++ id)
+            {
+                sRe -= k * sinv[id] * S[id];
+                sIm += k * cosv[id] * S[id];
+                dRe -= (cosv[id] + kr[id]*sinv[id]) * D[id];
+                dIm += (kr[id]*cosv[id] - sinv[id]) * D[id];
+            }
+
+            s_->B_(rowId,cId) = complex<REAL>(sRe, sIm);
+            s_->A_(rowId,cId) = complex<REAL>(dRe, dIm);
         }
         construct_R(rowId);
     }
@@ -56,34 +104,6 @@ struct _ParallelCBIEConstruct
         const complex<REAL> i4pik = complex<REAL>(0,1./(4.*M_PI*s_->k_)); // *= i/(4*pi*k)
         s_->B_(rId,rId) -= sum1 * i4pik * complex<REAL>(0, s_->k_)* s_->crho_;  // *ik*rho*c
     }
-
-    void construct_SD(size_t rId, size_t cId) const
-    {
-        complex<REAL> sij(0,0);
-        complex<REAL> dij(0,0);
-
-        for(size_t gi = 0;gi < spec_->nGaussPts;++ gi)
-        {
-            // gaussian point --> tri[rId] center
-            Vector3<REAL> r = spec_->triCenters[rId] - spec_->gaussPts[cId][gi];
-            REAL lenr  = r.length();
-            REAL lenr2 = lenr*lenr;                                 // r^2
-
-            s_->derCacheS_[rId][cId][gi] = spec_->gaussWeights[cId][gi]*
-                    s_->crho_ / (4.*M_PI*lenr);
-            /* ik*c*rho*exp(ikr)/(4*PI*r)*/
-            sij += complex<REAL>(0, s_->k_)*std::exp(complex<REAL>(0,s_->k_*lenr))*
-                    s_->derCacheS_[rId][cId][gi];
-
-            s_->derCacheD_[rId][cId][gi] = -spec_->gaussWeights[cId][gi] * 
-                    r.dot(spec_->triNormals[cId]) / (4.*M_PI*lenr2*lenr);
-            /* (-1+ikr)*exp(ikr)*-<r.n>/(4*PI*r^3) */
-            dij += complex<REAL>(-1,s_->k_*lenr)*std::exp(complex<REAL>(0,s_->k_*lenr))*
-                    s_->derCacheD_[rId][cId][gi];
-        }
-        s_->B_(rId,cId) = sij;
-        s_->A_(rId,cId) = dij;
-    }
 };
 
 void CBIESolver::solve(REAL freq)
@@ -94,6 +114,7 @@ void CBIESolver::solve(REAL freq)
     PRINT_MSG("Construct the linear system ...\n");
     tbb::parallel_for(tbb::blocked_range<size_t>(0, nEles_), 
                       _ParallelCBIEConstruct(this));
+    cached_ = true;
     b_ = B_ * spec_->normalVel;
 
     PRINT_MSG("QR Factorization of A ...\n");
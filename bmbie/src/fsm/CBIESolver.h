@@ -1,8 +1,8 @@
 #ifndef CBIE_SOLVER_INC
 #   define CBIE_SOLVER_INC
 
-#include <boost/multi_array.hpp>
 #include "BIESolver.h"
+#include "CBIECache.h"
 
 /*
  * Helmholtz CBIE Solver 
@@ -12,17 +12,19 @@ class CBIESolver : public BIESolver
     friend struct _ParallelCBIEConstruct;
 
     public:
-        typedef boost::multi_array<REAL, 3>     TDCArray;
-
-        CBIESolver(const BIESpec* spec);
+        /*
+         * Keeps up to maxCacheBytes of the frequency-independent
+         * coefficients in memory and up to maxDiskBytes more in a mapped
+         * file (see CBIEDerivCache); the rest is recomputed at each solve
+         */
+        CBIESolver(const BIESpec* spec, size_t maxCacheBytes = 0,
+                   size_t maxDiskBytes = 0, const char* spillDir = NULL);
 
         void solve(REAL freq);
 
     private:
-        bool                cached_;        // used for sweeping
-        TDCArray            derCacheD_;
-        TDCArray            derCacheS_;
-        Eigen::ColPivHouseholderQR<TMatrixXc> qr_;
+        bool                cached_;        // used for sweeping: derCache_ filled by a previous solve
+        CBIEDerivCache      derCache_;
 };
 
 #endif
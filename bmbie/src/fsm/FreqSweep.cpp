@@ -0,0 +1,152 @@
+#include "FreqSweep.h"
+#include <thread>
+#include <algorithm>
+#include <unistd.h>
+#include <tbb/task_arena.h>
+#include "BMBIESolver.h"
+#include "utils/term_msg.h"
+
+using namespace std;
+
+/* fraction of the free memory the solvers may take */
+static const double SWEEP_MEMORY_SHARE = 0.8;
+
+FreqSweep::FreqSweep(const BIESpec* spec, const vector< Vector3<REAL> >& ears):
+        spec_(spec), ears_(ears), nWorkers_(1), nThreadsPerWorker_(1),
+        cacheBytes_(0), cache_(NULL), nextFreq_(0)
+{
+    plan();
+}
+
+size_t FreqSweep::solver_bytes(size_t nEles, size_t nEars)
+{
+    /*
+     * A_, B_ and the QR factors: three dense complex n x n matrices, plus
+     * lp, lv and the weights in computeWeightMatrix: three n x nEars
+     */
+    const size_t n = nEles;
+    return 3 * n * n * sizeof(complex<REAL>) + 8 * n * sizeof(complex<REAL>) +
+           3 * n * nEars * sizeof(complex<REAL>) + 4 * n * nEars * sizeof(REAL);
+}
+
+size_t FreqSweep::available_memory()
+{
+#ifdef _SC_AVPHYS_PAGES
+    const long pages = sysconf(_SC_AVPHYS_PAGES);
+#else
+    const long pages = sysconf(_SC_PHYS_PAGES) / 2;
+#endif
+    const long pageSize = sysconf(_SC_PAGESIZE);
+    if ( pages <= 0 || pageSize <= 0 ) return 0;
+    return (size_t)pages * (size_t)pageSize;
+}
+
+void FreqSweep::plan(int nThreads, size_t maxBytes, size_t maxCacheBytes)
+{
+    if ( nThreads <= 0 ) nThreads = max(1, (int)thread::hardware_concurrency());
+    if ( maxBytes == 0 ) maxBytes = (size_t)(available_memory() * SWEEP_MEMORY_SHARE);
+
+    const size_t perSolver = solver_bytes(spec_->triangles.size(), ears_.size());
+    const int byMemory = (int)max((size_t)1, maxBytes / perSolver);
+
+    nWorkers_ = max(1, min(min(nThreads, spec_->nFreq), byMemory));
+    nThreadsPerWorker_ = max(1, nThreads / nWorkers_);
+
+    const size_t solvers = nWorkers_ * perSolver;
+    cacheBytes_ = min(maxCacheBytes, maxBytes > solvers ? maxBytes - solvers : 0);
+}
+
+/*
+ * Solves one frequency inside a worker's task arena
+ */
+struct _SweepSolve
+{
+    BMBIESolver*            solver_;
+    REAL                    freq_;
+    const vector< Vector3<REAL> >*  ears_;
+    Eigen::MatrixXcd*       wts_;
+
+    _SweepSolve(BMBIESolver* s, REAL f, const vector< Vector3<REAL> >* ears, Eigen::MatrixXcd* wts):
+            solver_(s), freq_(f), ears_(ears), wts_(wts) { }
+
+    void operator() () const
+    {
+        solver_->solve(freq_);
+        solver_->computeWeightMatrix(*ears_, *wts_);
+    }
+};
+
+/*
+ * Takes the next unsolved frequency until there is none left
+ */
+struct _SweepWorker
+{
+    FreqSweep*  sweep_;
+
+    _SweepWorker(FreqSweep* s):sweep_(s) { }
+
+    void operator() () const
+    {
+        BMBIESolver solver(sweep_->spec_);
+        solver.use_cache(sweep_->cache_);
+        tbb::task_arena arena(sweep_->nThreadsPerWorker_);
+        Eigen::MatrixXcd wts;
+
+        for(;;)
+        {
+            int freqId;
+            {
+                lock_guard<mutex> lock(sweep_->mutex_);
+                if ( sweep_->nextFreq_ >= sweep_->spec_->nFreq ) return;
+                freqId = sweep_->nextFreq_ ++;
+            }
+
+            arena.execute(_SweepSolve(&solver, sweep_->frequency(freqId), &sweep_->ears_, &wts));
+
+            {
+                lock_guard<mutex> lock(sweep_->mutex_);
+                sweep_->results_[freqId].swap(wts);
+                sweep_->done_[freqId] = 1;
+            }
+            sweep_->finished_.notify_all();
+        }
+    }
+};
+
+void FreqSweep::run(SweepOutput& out)
+{
+    const int nFreq = spec_->nFreq;
+
+    PRINT_MSG(" Sweep: %d frequencies, %d listener(s), %d worker(s) x %d thread(s), %.1f MB per solver\n",
+              nFreq, (int)ears_.size(), nWorkers_, nThreadsPerWorker_,
+              (double)solver_bytes(spec_->triangles.size(), ears_.size()) / (1024.*1024.));
+
+    /* the frequency-independent part of the assembly, shared by all workers */
+    BMBIEGeometryCache cache(spec_, cacheBytes_);
+    cache_ = &cache;
+    PRINT_MSG(" Geometry cache: %d of %d rows, %.1f MB\n",
+              (int)cache.num_cached_rows(), (int)spec_->triangles.size(),
+              (double)cache.memory() / (1024.*1024.));
+
+    nextFreq_ = 0;
+    results_.assign(nFreq, Eigen::MatrixXcd());
+    done_.assign(nFreq, 0);
+
+    vector<thread> workers;
+    for(int i = 0;i < nWorkers_;++ i)
+        workers.push_back(thread(_SweepWorker(this)));
+
+    /* write the results out in order, as soon as each one is there */
+    for(int i = 0;i < nFreq;++ i)
+    {
+        {
+            unique_lock<mutex> lock(mutex_);
+            while ( !done_[i] ) finished_.wait(lock);
+        }
+        out.write(i, frequency(i), results_[i]);
+        Eigen::MatrixXcd().swap(results_[i]);
+    }
+
+    for(size_t i = 0;i < workers.size();++ i) workers[i].join();
+    cache_ = NULL;
+}
@@ -0,0 +1,87 @@
+#ifndef FSM_FREQ_SWEEP_INC
+#   define FSM_FREQ_SWEEP_INC
+
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <Eigen/Dense>
+#include "BIESpec.h"
+#include "BMBIECache.h"
+
+/*
+ * Receives the result of each frequency of a sweep, in frequency order:
+ * the weights of all the listeners, one column per listener
+ */
+struct SweepOutput
+{
+    virtual ~SweepOutput() { }
+
+    virtual void write(int freqId, REAL freq, const Eigen::MatrixXcd& wts) = 0;
+};
+
+/*
+ * Runs the frequencies of spec->freqRange concurrently, each worker
+ * thread with its own BMBIESolver (the linear systems of different
+ * frequencies are independent), and hands the weights of all the
+ * listeners (BMBIESolver::computeWeightMatrix) to a SweepOutput in
+ * frequency order as they become available.
+ *
+ * Within one solve only the matrix construction is parallel; the QR
+ * factorization is serial. So frequencies are spread over as many workers
+ * as the cores and the memory allow, and the cores left over go to the
+ * construction inside each worker (through its own tbb::task_arena).
+ */
+class FreqSweep
+{
+    friend struct _SweepWorker;
+
+    public:
+        FreqSweep(const BIESpec* spec, const std::vector< Vector3<REAL> >& ears);
+
+        /*
+         * Splits nThreads threads (0: one per core) between frequencies and
+         * the solves within them, keeping the solvers within maxBytes of
+         * memory (0: most of what is free now). What memory the solvers
+         * leave, up to maxCacheBytes, goes to a BMBIEGeometryCache shared
+         * by all of them.
+         */
+        void plan(int nThreads = 0, size_t maxBytes = 0, size_t maxCacheBytes = (size_t)-1);
+
+        int num_workers() const
+        {   return nWorkers_; }
+
+        int threads_per_worker() const
+        {   return nThreadsPerWorker_; }
+
+        size_t cache_bytes() const
+        {   return cacheBytes_; }
+
+        REAL frequency(int freqId) const
+        {   return spec_->freqRange.first + spec_->freqDelta*(REAL)freqId; }
+
+        /* memory (in bytes) one BMBIESolver needs for nEles elements and nEars listeners */
+        static size_t solver_bytes(size_t nEles, size_t nEars = 1);
+
+        /* physical memory (in bytes) not in use right now */
+        static size_t available_memory();
+
+        void run(SweepOutput& out);
+
+    private:
+        const BIESpec*                  spec_;
+        std::vector< Vector3<REAL> >    ears_;
+
+        int                             nWorkers_;
+        int                             nThreadsPerWorker_;
+        size_t                          cacheBytes_;
+        const BMBIEGeometryCache*       cache_;
+
+        /* shared between the workers and run(), under mutex_ */
+        std::mutex                      mutex_;
+        std::condition_variable         finished_;
+        int                             nextFreq_;
+        std::vector<Eigen::MatrixXcd>   results_;
+        std::vector<char>               done_;
+};
+
+#endif
@@ -1,10 +1,13 @@
 #include <iostream>
 #include <fstream>
 #include <iomanip>
+#include <cstring>
+#include <cstdlib>
 #include <tbb/task_scheduler_init.h>
 #include "utils/term_msg.h"
 #include "fsm/BIESpec.h"
 #include "fsm/BMBIESolver.h"
+#include "fsm/FreqSweep.h"
 #include "fsm/dunavant.hpp"
 //#include "utils/nano_timer.h"
 #include "gauss_quadra/gauss_legendre.h"
@@ -58,57 +61,107 @@ static void load_problem(const char* filename)
   spec->init(orderNum, xy.data(), wtab, nGaussQuad, gaussQuadX, gaussQuadW);
 }
 
+/*
+ * Reads the listening positions, one "x y z" per line
+ */
+static void load_listeners(const char* filename, vector< Vector3<double> >& ears)
+{
+  ifstream fin(filename);
+  if ( fin.fail() )
+  {
+    PRINT_ERROR("Cannot open the listener file %s\n", filename);
+    SHOULD_NEVER_HAPPEN(-1);
+  }
+  
+  Vector3<double> ear;
+  while ( fin >> ear.x >> ear.y >> ear.z ) ears.push_back(ear);
+  
+  if ( ears.empty() )
+  {
+    PRINT_ERROR("No listening position in %s\n", filename);
+    SHOULD_NEVER_HAPPEN(-1);
+  }
+}
+
+/*
+ * Writes the weights of the air triangles, one frequency after another.
+ * Each line is one triangle, with the real and imaginary weights of every
+ * listener in the order of the listener file.
+ */
+struct _WeightWriter : public SweepOutput
+{
+  ofstream& fout_;
+  size_t    nAirTris_;
+  
+  _WeightWriter(ofstream& fout, size_t nAirTris):fout_(fout), nAirTris_(nAirTris) { }
+  
+  void write(int freqId, REAL freq, const Eigen::MatrixXcd& wts)
+  {
+    PRINT_MSG(" Freq: %f  done (%d/%d)\n", freq, freqId+1, spec->nFreq);
+    for (size_t i = 0; i < nAirTris_; i++) {
+      for (Eigen::Index e = 0; e < wts.cols(); e++) {
+        if ( e ) fout_ << "     ";
+        fout_ << wts(i,e).real() << "     " << wts(i,e).imag();
+      }
+      fout_ << std::endl;
+    }
+  }
+};
+
+static void usage(const char* prog)
+{
+  cerr << "Usage: " << prog << " [-j threads] [-m memory-MB] [-c cache-MB] [-l listeners.txt] [input.dat] [output-N.dat]" << endl;
+}
+
 int main(int argc, char* argv[])
 {
-  if ( argc != 3 )
+  int nThreads = 0;         // 0: one per core
+  size_t maxBytes = 0;      // 0: most of the free memory
+  size_t maxCacheBytes = (size_t)-1;
+  const char* listenerFile = NULL;  // NULL: the one listener at (2, 3, 4)
+  vector<const char*> files;
+  
+  for(int i = 1;i < argc;++ i)
   {
-    cerr << "Usage: " << argv[0] << " [input.dat] [output-N.dat]" << endl;
+    if ( !strcmp(argv[i], "-j") && i+1 < argc )
+      nThreads = atoi(argv[++ i]);
+    else if ( !strcmp(argv[i], "-m") && i+1 < argc )
+      maxBytes = (size_t)atol(argv[++ i]) << 20;
+    else if ( !strcmp(argv[i], "-c") && i+1 < argc )
+      maxCacheBytes = (size_t)atol(argv[++ i]) << 20;
+    else if ( !strcmp(argv[i], "-l") && i+1 < argc )
+      listenerFile = argv[++ i];
+    else
+      files.push_back(argv[i]);
   }
   
-  tbb::task_scheduler_init init;
-  load_problem(argv[1]);
+  if ( files.size() != 2 )
+  {
+    usage(argv[0]);
+    return 1;
+  }
   
-  BMBIESolver solver(spec);
+  tbb::task_scheduler_init init;
+  load_problem(files[0]);
   
   PRINT_MSG(" Freq. range [%f %f], %f\n", spec->freqRange.first, spec->freqRange.second, spec->freqDelta);
-  ofstream fout(argv[2]);
+  ofstream fout(files[1]);
   if ( fout.fail() ) SHOULD_NEVER_HAPPEN(-1);
   
   fout << setprecision(10);
-  // const double st = milli_time_d();
-  for(int i = 0;i < spec->nFreq;++ i)
-  {
-    REAL f0 = spec->freqRange.first + spec->freqDelta*(REAL)i;
-    PRINT_MSG(" Freq: %f  size: %d\n", f0, int(solver.num_eles()) );
-    solver.solve(f0);
-    
-    Eigen::VectorXcd wts;
-    const Vector3<double> ear(2., 3., 4.);
-    solver.computeWeightVector(ear, wts);
-    
-    /*
-    for (size_t i = 0; i < spec->triangles.size(); i++) {
-      std::cout << "weight:   " << wts(i) << std::endl;
-    }*/
-
-    /*
-    const BIESolver::TVectorXc& sol = solver.solution();
-    fout << " ~~~~~~~~~~~~~~~~ " << endl;
-    fout << " Freq. No. = " << i << ", Freq. = " << f0 << " (Hz)" << endl;
-    fout << " Element #          Pressure" << endl;
-    
-    for(int j = 0;j < solver.num_eles();++ j)
-    {
-      fout << j+1 << "  ( " << sol(j).real() << ", " << sol(j).imag() << ") " << endl;
-    }
-    */
-    //   double tnow = milli_time_d();
-    //   PRINT_MSG("Estimated time remaining: %f hrs\n", (tnow - st) / double(i+1) * double(spec->nFreq-i-1) / 3600.);
-    
-    for (size_t i = 0; i < spec->nAirTris; i++) {
-      fout << wts(i).real() << "     " << wts(i).imag() << std::endl;
-    }
-  }
+  
+  vector< Vector3<double> > ears;
+  if ( listenerFile )
+    load_listeners(listenerFile, ears);
+  else
+    ears.push_back(Vector3<double>(2., 3., 4.));
+  
+  FreqSweep sweep(spec, ears);
+  sweep.plan(nThreads, maxBytes, maxCacheBytes);
+  
+  _WeightWriter writer(fout, spec->nAirTris);
+  sweep.run(writer);
+  
   fout.close();
   return 0;
 }
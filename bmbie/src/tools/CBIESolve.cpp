@@ -0,0 +1,116 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <cstring>
+#include <cstdlib>
+#include <tbb/task_scheduler_init.h>
+#include "utils/term_msg.h"
+#include "fsm/BIESpec.h"
+#include "fsm/CBIESolver.h"
+#include "fsm/dunavant.hpp"
+#include "gauss_quadra/gauss_legendre.h"
+
+using namespace std;
+
+static BIESpec* spec = NULL;
+
+static void load_problem(const char* filename)
+{
+  spec = load_from_fastbem_input(filename);
+
+  const int nGaussQuad = 10;
+  REAL gaussQuadX[nGaussQuad], gaussQuadW[nGaussQuad];
+
+  gauss_legendre_tbl(nGaussQuad, gaussQuadX, gaussQuadW, 1e-10);
+
+  int cc = (nGaussQuad+1)>>1;
+  int pp = nGaussQuad>>1;
+  if ( nGaussQuad&1 )  // odd
+  {
+    for(int i = 1;i < cc;++ i)
+    {
+      gaussQuadX[i+pp] = -gaussQuadX[i];
+      gaussQuadW[i+pp] =  gaussQuadW[i];
+    }
+  }
+  else
+  {
+    for(int i = 0;i < cc;++ i)
+    {
+      gaussQuadX[i+pp] = -gaussQuadX[i];
+      gaussQuadW[i+pp] =  gaussQuadW[i];
+    }
+  }
+
+  int rule = 6;
+  int orderNum = dunavant_order_num(rule);
+  double* xytab = new double[2*orderNum];
+  double*  wtab = new double[orderNum];
+  dunavant_rule(rule, orderNum, xytab, wtab);
+  vector< Point3<REAL> > xy(orderNum);
+  for(int i = 0;i < orderNum;++ i)
+    xy[i].set(xytab[i*2], xytab[i*2+1], (1.-xytab[i*2]-xytab[i*2+1]));
+
+  spec->init(orderNum, xy.data(), wtab, nGaussQuad, gaussQuadX, gaussQuadW);
+}
+
+static void usage(const char* prog)
+{
+  cerr << "Usage: " << prog << " [-c cache-MB] [-d disk-MB] [-t spill-dir] [input.dat] [output.dat]" << endl;
+}
+
+/*
+ * Solves the CBIE at every frequency of the input, one after another, so
+ * that the solves after the first reuse the cached coefficients. The
+ * output has the surface pressure of every triangle, one "real imag" line
+ * per triangle, one frequency after another.
+ */
+int main(int argc, char* argv[])
+{
+  size_t maxCacheBytes = 0;
+  size_t maxDiskBytes = 0;
+  const char* spillDir = NULL;      // NULL: $TMPDIR or /tmp
+  vector<const char*> files;
+
+  for(int i = 1;i < argc;++ i)
+  {
+    if ( !strcmp(argv[i], "-c") && i+1 < argc )
+      maxCacheBytes = (size_t)atol(argv[++ i]) << 20;
+    else if ( !strcmp(argv[i], "-d") && i+1 < argc )
+      maxDiskBytes = (size_t)atol(argv[++ i]) << 20;
+    else if ( !strcmp(argv[i], "-t") && i+1 < argc )
+      spillDir = argv[++ i];
+    else
+      files.push_back(argv[i]);
+  }
+
+  if ( files.size() != 2 )
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  tbb::task_scheduler_init init;
+  load_problem(files[0]);
+
+  PRINT_MSG(" Freq. range [%f %f], %f\n", spec->freqRange.first, spec->freqRange.second, spec->freqDelta);
+  ofstream fout(files[1]);
+  if ( fout.fail() ) SHOULD_NEVER_HAPPEN(-1);
+
+  fout << setprecision(10);
+
+  CBIESolver solver(spec, maxCacheBytes, maxDiskBytes, spillDir);
+  for(int fi = 0;fi < spec->nFreq;++ fi)
+  {
+    const REAL freq = spec->freqRange.first + fi * spec->freqDelta;
+    solver.solve(freq);
+    PRINT_MSG(" Freq: %f  done (%d/%d)\n", freq, fi+1, spec->nFreq);
+
+    const BIESolver::TVectorXc& x = solver.solution();
+    for(Eigen::Index i = 0;i < x.size();++ i)
+      fout << x(i).real() << "     " << x(i).imag() << endl;
+  }
+
+  fout.close();
+  return 0;
+}
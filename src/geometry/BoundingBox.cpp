@@ -32,3 +32,8 @@ bool BoundingBox::contains(const Vector3d &p) const {
 	  && p[2] < boxmax[2]);
 }
 
+
+double BoundingBox::distance(const BoundingBox &other) const {
+  Vector3d gap = (other.boxmin - boxmax).cwiseMax(boxmin - other.boxmax);
+  return gap.cwiseMax(Vector3d::Zero()).norm();
+}
@@ -27,7 +27,11 @@ class BoundingBox {
     boxmax = bmax;
   }
   
+  const Vector3d &GetBoxmin() const { return boxmin; }
   const Vector3d &GetBoxmax() const { return boxmax; }
+  
+  // Shortest distance between the two boxes (zero if they overlap)
+  double distance(const BoundingBox &other) const;
 
   const Vector3d getBoxCenter() const {
     return (boxmin + boxmax) * 0.5;
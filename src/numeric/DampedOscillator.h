@@ -0,0 +1,227 @@
+//
+//  DampedOscillator.h
+//  aletler
+//
+//  Exact stepping for the damped oscillator  x'' + beta x' + omega^2 x = 0.
+//  Over a step of length h with omega and beta held constant, the state
+//  (x, x') is multiplied by a fixed 2x2 matrix, so a step costs a handful
+//  of multiply-adds once that matrix is known. When omega and beta vary
+//  slowly (e.g. linearly between animation keyframes), freezing them at the
+//  midpoint of each audio sample step is accurate to second order, and
+//  unlike RK4 it stays stable and undamped-correct for any omega * h.
+//  Between keyframes the matrix of one step is updated from the one of the
+//  step before (integrateDampedRamp), so it is only computed from scratch
+//  every DAMPED_OSCILLATOR_RESEED steps.
+//
+
+#ifndef aletler_DampedOscillator_h
+#define aletler_DampedOscillator_h
+
+#include <cmath>
+#include <vector>
+#include <limits>
+
+
+class DampedOscillatorStep {
+
+public:
+
+  // Propagator over a step h for constant omega (rad/s) and beta (1/s)
+  void set(double omega, double beta, double h) {
+
+    if (omega <= 0) {
+      // no restoring force (e.g. outside the keyframes): free motion
+      m00 = 1; m01 = h;
+      m10 = 0; m11 = 1;
+      return;
+    }
+
+    double a = 0.5 * beta;
+    double wd2 = omega * omega - a * a;
+    double e = exp(-a * h);
+
+    // c = cos(wd h), sw = sin(wd h) / wd, continued to the overdamped and
+    // critically damped cases
+    double c, sw;
+    if (wd2 > 0) {
+      double wd = sqrt(wd2);
+      c = cos(wd * h);
+      sw = sin(wd * h) / wd;
+    } else if (wd2 < 0) {
+      double mu = sqrt(-wd2);
+      c = cosh(mu * h);
+      sw = sinh(mu * h) / mu;
+    } else {
+      c = 1;
+      sw = h;
+    }
+
+    m00 = e * (c + a * sw);
+    m01 = e * sw;
+    m10 = -e * omega * omega * sw;
+    m11 = e * (c - a * sw);
+  }
+
+  void apply(double &x, double &v) const {
+    double xn = m00 * x + m01 * v;
+    v = m10 * x + m11 * v;
+    x = xn;
+  }
+
+  double m00, m01, m10, m11;
+};
+
+
+// Number of steps of size h that fit in [t0, t1], counted the same way as
+// boost::numeric::odeint::integrate_const (which also observes t0).
+inline size_t numConstSteps(double t0, double t1, double h) {
+
+  if (t1 < t0) return 0;
+
+  size_t n = size_t(floor((t1 - t0) / h));
+  const double eps = std::numeric_limits<double>::epsilon();
+
+  while (n > 0 && (t0 + n * h) - t1 > eps) n--;
+  while ((t0 + (n + 1) * h) - t1 <= eps) n++;
+
+  return n;
+}
+
+
+// Steps between exact recomputations of the propagator in
+// integrateDampedRamp, so that rounding in its recurrences cannot build up
+#define DAMPED_OSCILLATOR_RESEED 64
+
+
+// Steps (x, v) n times by h, with omega and beta going linearly (in the step
+// index) from (omega0, beta0) at the first step to (omega1, beta1) at the
+// last, and writes x after each step into out[0..n-1].
+//
+// In the underdamped case the decay a = beta / 2 and the damped frequency
+// wd = sqrt(omega^2 - a^2) are interpolated instead. Then e^{-a h} changes by
+// a constant factor from one step to the next, and (cos(wd h), sin(wd h)) by
+// a constant rotation, so the propagator is updated with a few multiply-adds
+// and a division rather than recomputed with exp, sqrt, cos and sin. Over a
+// keyframe interval wd differs from the one of the interpolated omega and
+// beta by a term of order a^2 / omega times the square of the relative
+// change in omega.
+inline void integrateDampedRamp(double omega0, double beta0,
+                                double omega1, double beta1,
+                                double h, size_t n,
+                                double &x, double &v, double *out) {
+
+  if (n == 0) return;
+
+  double a0 = 0.5 * beta0, a1 = 0.5 * beta1;
+  double wd20 = omega0 * omega0 - a0 * a0;
+  double wd21 = omega1 * omega1 - a1 * a1;
+  double last = n > 1 ? double(n - 1) : 1.0;
+
+  if (omega0 <= 0 || omega1 <= 0 || wd20 <= 0 || wd21 <= 0) {
+    DampedOscillatorStep step;
+    for (size_t s = 0; s < n; s++) {
+      double f = s / last;
+      step.set(omega0 + (omega1 - omega0) * f, beta0 + (beta1 - beta0) * f, h);
+      step.apply(x, v);
+      out[s] = x;
+    }
+    return;
+  }
+
+  const double wd0 = sqrt(wd20);
+  const double dwd = (sqrt(wd21) - wd0) / last;
+  const double da = (a1 - a0) / last;
+
+  // per-step rotation and decay factors
+  const double cd = cos(dwd * h), sd = sin(dwd * h);
+  const double ed = exp(-da * h);
+
+  double wd = wd0, a = a0, c = 1, sn = 0, e = 1;
+
+  for (size_t s = 0; s < n; s++) {
+
+    if (s % DAMPED_OSCILLATOR_RESEED == 0) {
+      wd = wd0 + s * dwd;
+      a = a0 + s * da;
+      c = cos(wd * h);
+      sn = sin(wd * h);
+      e = exp(-a * h);
+    }
+
+    // as in DampedOscillatorStep::set
+    double sw = sn / wd;
+    double xn = e * ((c + a * sw) * x + sw * v);
+    v = e * (-(wd * wd + a * a) * sw * x + (c - a * sw) * v);
+    x = xn;
+    out[s] = x;
+
+    double cn = c * cd - sn * sd;
+    sn = sn * cd + c * sd;
+    c = cn;
+    e *= ed;
+    wd += dwd;
+    a += da;
+  }
+}
+
+
+// Integrates from state (x, v) at time t0 for nsteps steps of size h, where
+// omega and beta are given at keyframe times (sorted) and are linear in between.
+// Each step uses omega and beta at its midpoint. Writes x at t0, t0 + h, ...
+// into out[0..nsteps] (nsteps + 1 values).
+//
+// The steps are taken in runs whose midpoints share a keyframe interval
+// (or lie before the first or after the last keyframe), each integrated
+// by integrateDampedRamp.
+inline void integrateDampedOscillator(const std::vector<double> &times,
+                                      const std::vector<double> &omegas,
+                                      const std::vector<double> &betas,
+                                      double t0, double h, size_t nsteps,
+                                      double x, double v,
+                                      double *out) {
+
+  out[0] = x;
+
+  size_t k = 0;
+  size_t s = 0;
+
+  while (s < nsteps) {
+
+    double tm = t0 + (s + 0.5) * h;
+
+    // keyframe interval [k, k+1] containing the midpoint of this step
+    while (k + 2 < times.size() && times[k + 1] < tm) k++;
+
+    // the run of steps, from s to end - 1, in the same part of the timeline
+    size_t end = s + 1;
+    double omega0, beta0, omega1, beta1;
+
+    if (times.size() < 2 || tm <= times[0]) {
+      while (end < nsteps && (times.size() < 2 || t0 + (end + 0.5) * h <= times[0])) end++;
+      omega0 = omega1 = omegas[0];
+      beta0 = beta1 = betas[0];
+    } else if (tm >= times.back()) {
+      end = nsteps;
+      omega0 = omega1 = omegas.back();
+      beta0 = beta1 = betas.back();
+    } else {
+      double tk = times[k], tk1 = times[k + 1];
+      double upper = k + 2 < times.size() ? tk1 : std::nextafter(tk1, tk);
+      while (end < nsteps && t0 + (end + 0.5) * h <= upper) end++;
+
+      double a = (tm - tk) / (tk1 - tk);
+      omega0 = omegas[k] * (1 - a) + omegas[k + 1] * a;
+      beta0 = betas[k] * (1 - a) + betas[k + 1] * a;
+
+      a = (t0 + (end - 0.5) * h - tk) / (tk1 - tk);
+      omega1 = omegas[k] * (1 - a) + omegas[k + 1] * a;
+      beta1 = betas[k] * (1 - a) + betas[k + 1] * a;
+    }
+
+    integrateDampedRamp(omega0, beta0, omega1, beta1, h, end - s, x, v, out + s + 1);
+    s = end;
+  }
+}
+
+
+#endif
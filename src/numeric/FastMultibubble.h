@@ -21,6 +21,8 @@ enum FastMBBlock {FMB_Abb, FMB_B, FMB_C, FMB_D};
 class FastMultibubble {
 public:
   
+  FastMultibubble() : _Abb_LU_valid(false) {}
+  
   // assumes that matrix m is the full size of A = [A_bb B  | C D] but that
   // D has not necessarily been set
   // nb is the number of mesh elements that comprise the bubble. Note that
@@ -48,6 +50,24 @@ public:
 
   }
   
+  // Same as above, but aLU is a factorization of a that was computed earlier
+  // (e.g. for a bubble that has only translated since), so it is not redone.
+  void setBubbleMatrices(const MatrixXd &a,
+                         const FullPivLU<MatrixXd> &aLU,
+                         const MatrixXd &b,
+                         const MatrixXd &c) {
+    _Abb = a;
+    _Abb_LU = aLU;
+    _Abb_LU_valid = true;
+    setMatrixBlock(b, FMB_B);
+    setMatrixBlock(c, FMB_C);
+  }
+  
+  const FullPivLU<MatrixXd> &bubbleLU() {
+    factorBubbleMatrix();
+    return _Abb_LU;
+  }
+  
   
   // this assumes that matrix m is the specific block you want to set
   void setDomainMatrix(const MatrixXd &m) {
@@ -60,6 +80,7 @@ public:
     // solve one linear equation per bubble:
     
     fastInverseSetup();
+    factorBubbleMatrix();
     
     x.resize(_Abb.rows() + _D.rows(), 1);
     
@@ -90,6 +111,24 @@ public:
     
   }
 
+  
+  // Solves for several right-hand sides at once, one per column (e.g. one per
+  // bubble when Abb holds all the bubbles of a frame). Only the Schur complement
+  // X = Abb - B D^-1 C is factored here; D is applied through its existing
+  // factorization and Abb itself is never inverted.
+  void solveMultiple(const MatrixXd &rhs, MatrixXd &x) {
+    
+    fastInverseSetup();
+    
+    size_t nb = _Abb.rows();
+    size_t nd = _D.rows();
+    x.resize(nb + nd, rhs.cols());
+    
+    MatrixXd t1 = _D_LU.solve(rhs.bottomRows(nd));
+    x.topRows(nb) = _X_LU.solve(rhs.topRows(nb) - _B * t1);
+    x.bottomRows(nd) = _D_LU.solve(rhs.bottomRows(nd) - _C * x.topRows(nb));
+  }
+
   /*
   void solve_slow(const VectorXd &rhs, VectorXd &x) {
    // std::cout << _A.rows() << "  x  " << _A.cols()  << std::endl;
@@ -126,10 +165,18 @@ private:
   FullPivLU<MatrixXd> _D_LU;
   FullPivLU<MatrixXd> _X_LU;
   
+  // The factorization of Abb is only needed by solve(), so it is computed lazily
+  bool _Abb_LU_valid;
+  
+  void factorBubbleMatrix() {
+    if (!_Abb_LU_valid) {
+      _Abb_LU = FullPivLU<MatrixXd>(_Abb);
+      _Abb_LU_valid = true;
+    }
+  }
+  
   void fastInverseSetup() {
 
-    _Abb_LU = FullPivLU<MatrixXd>(_Abb);
-
     MatrixXd T1 = _D_LU.solve(_C);
     _X_LU = FullPivLU<MatrixXd>(_Abb - _B * T1);
     
@@ -143,6 +190,7 @@ private:
     switch (block) {
       case FMB_Abb:
         _Abb = m;
+        _Abb_LU_valid = false;
         break;
       case FMB_B:
         _B = m;
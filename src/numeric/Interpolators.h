@@ -9,9 +9,15 @@
 #ifndef aletler_Interpolators_h
 #define aletler_Interpolators_h
 
+#include <vector>
+#include <complex>
+#include <algorithm>
+#include <iostream>
+#include <cassert>
+
 
 // Interp y corresponding to x, depending on distance between x0 and x1
-static double interpLinearDouble(double x,
+inline double interpLinearDouble(double x,
                                  double x0, double x1,
                                  double y0, double y1) {
   
@@ -23,7 +29,7 @@ static double interpLinearDouble(double x,
 
 
 // Interp y corresponding to x, depending on distance between x0 and x1
-static std::complex<double> interpLinearComplex(double x,
+inline std::complex<double> interpLinearComplex(double x,
                                                 double x0, double x1,
                                                 std::complex<double> y0, std::complex<double> y1) {
   
@@ -41,13 +47,14 @@ static std::complex<double> interpLinearComplex(double x,
 // Interp y corresponding to x, based on sequence of values in xvec & yvec
 // If outside of range, returns whatever value user specifies as "out_of_range"
 // (optional parameter)
-static double interpLinearVectors(double x,
+inline double interpLinearVectors(double x,
                                   const std::vector<double> &xvec,
                                   const std::vector<double> &yvec,
                                   double out_of_range = 0) {
   
+  // (written so that NaN is out of range too)
   if (xvec.empty()
-      || x < xvec[0] || x > xvec.back()) {
+      || !(x >= xvec[0] && x <= xvec.back())) {
     return out_of_range;
   }
   
@@ -57,29 +64,15 @@ static double interpLinearVectors(double x,
   }
   
   
-  for (size_t i = 1; i < xvec.size(); i++) {
-    double xcurr = xvec[i - 1];
-    double xnext = xvec[i];
-    
-    double ycurr = yvec[i - 1];
-    double ynext = yvec[i];
-    
-    
-    if (x == xcurr)
-      return ycurr;
-    if (x == xnext)
-      return ynext;
-    
-    if (x > xcurr && x < xnext) {
-      return interpLinearDouble(x,
-                                xcurr, xnext,
-                                ycurr, ynext);
-    }
-  }
+  // first key >= x, which exists because x <= xvec.back()
+  size_t i = std::lower_bound(xvec.begin(), xvec.end(), x) - xvec.begin();
+  
+  if (x == xvec[i])
+    return yvec[i];
   
-  // Never reached because of program logic. This is here to avoid
-  // compiler errors:
-  return yvec.back();
+  return interpLinearDouble(x,
+                            xvec[i - 1], xvec[i],
+                            yvec[i - 1], yvec[i]);
 }
 
 
@@ -87,13 +80,14 @@ static double interpLinearVectors(double x,
 // Interp y corresponding to x, based on sequence of values in xvec & yvec
 // If outside of range, returns whatever value user specifies as "out_of_range"
 // (optional parameter)
-static std::complex<double> interpLinearComplexVectors(double x,
+inline std::complex<double> interpLinearComplexVectors(double x,
                                                 const std::vector<double> &xvec,
                                                 const std::vector<std::complex<double> > &yvec,
                                                 std::complex<double> out_of_range = std::complex<double>(0,0)) {
   
+  // (written so that NaN is out of range too)
   if (xvec.empty()
-      || x < xvec[0] || x > xvec.back()) {
+      || !(x >= xvec[0] && x <= xvec.back())) {
     return out_of_range;
   }
   
@@ -103,29 +97,237 @@ static std::complex<double> interpLinearComplexVectors(double x,
   }
   
   
-  for (size_t i = 1; i < xvec.size(); i++) {
-    double xcurr = xvec[i - 1];
-    double xnext = xvec[i];
+  // first key >= x, which exists because x <= xvec.back()
+  size_t i = std::lower_bound(xvec.begin(), xvec.end(), x) - xvec.begin();
+  
+  if (x == xvec[i])
+    return yvec[i];
+  
+  return interpLinearComplex(x,
+                             xvec[i - 1], xvec[i],
+                             yvec[i - 1], yvec[i]);
+}
+
+
+enum InterpolationMode {
+  INTERP_LINEAR,
+  
+  // Cubic Hermite with finite difference (Catmull-Rom) slopes. Smooth, but may
+  // overshoot between keyframes.
+  INTERP_CUBIC,
+  
+  // Cubic Hermite with Fritsch-Butland slopes (as in PCHIP): never overshoots,
+  // so monotone data stays monotone. Complex values are limited per component.
+  INTERP_MONOTONE_HERMITE
+};
+
+
+// Slope at a key for INTERP_MONOTONE_HERMITE, given the secants d0, d1 and the
+// widths h0, h1 of the intervals to its left and right.
+inline double monotoneSlope(double d0, double d1, double h0, double h1) {
+  if (d0 * d1 <= 0) return 0;
+  
+  double w0 = 2 * h1 + h0;
+  double w1 = h1 + 2 * h0;
+  return (w0 + w1) / (w0 / d0 + w1 / d1);
+}
+
+inline std::complex<double> monotoneSlope(std::complex<double> d0, std::complex<double> d1,
+                                          double h0, double h1) {
+  return std::complex<double>(monotoneSlope(d0.real(), d1.real(), h0, h1),
+                              monotoneSlope(d0.imag(), d1.imag(), h0, h1));
+}
+
+
+// Interpolates a sequence of keyframes (x sorted, non-decreasing), with the same
+// results as interpLinearVectors in INTERP_LINEAR mode: exact keys return their
+// value, and anything outside [first key, last key] returns out_of_range.
+//
+// Lookups are O(log n). A caller that queries sequentially (e.g. once per
+// audio sample) can keep a cursor, which remembers the last interval so that
+// the next lookup costs O(1). The Hermite slopes are kept up to date as keys
+// are added, so a const interpolator is never modified and can be shared
+// between threads.
+template <typename T>
+class KeyframeInterpolator {
+  
+public:
+  
+  KeyframeInterpolator(InterpolationMode mode = INTERP_LINEAR,
+                       const T &out_of_range = T(0)) :
+  _mode(mode),
+  _out_of_range(out_of_range)
+  {}
+  
+  // Keys are appended in order, so only the slopes of the last two change
+  void addKey(double x, const T &y) {
+    _xs.push_back(x);
+    _ys.push_back(y);
+    _slopes.push_back(T(0));
     
-    std::complex<double> ycurr = yvec[i - 1];
-    std::complex<double> ynext = yvec[i];
+    size_t n = _xs.size();
+    if (n > 1) updateSlope(n - 2);
+    updateSlope(n - 1);
+  }
+  
+  void clear() {
+    _xs.clear();
+    _ys.clear();
+    _slopes.clear();
+  }
+  
+  InterpolationMode mode() const { return _mode; }
+  
+  void setMode(InterpolationMode mode) {
+    _mode = mode;
+    for (size_t i = 0; i < _xs.size(); i++) {
+      updateSlope(i);
+    }
+  }
+  
+  size_t size() const { return _xs.size(); }
+  bool empty() const { return _xs.empty(); }
+  
+  const std::vector<double> &keys() const { return _xs; }
+  const std::vector<T> &values() const { return _ys; }
+  
+  
+  T operator()(double x) const {
     
+    if (_xs.empty() || !inRange(x)) {
+      return _out_of_range;
+    }
     
-    if (x == xcurr)
-      return ycurr;
-    if (x == xnext)
-      return ynext;
+    size_t i = std::lower_bound(_xs.begin(), _xs.end(), x) - _xs.begin();
+    return interpolate(x, i);
+  }
+  
+  // Same as above, starting the search from cursor (initially 0), which is
+  // left at the interval of x for the next call. Any x is fine, but only
+  // non-decreasing ones are O(1).
+  T operator()(double x, size_t &cursor) const {
     
-    if (x > xcurr && x < xnext) {
-      return interpLinearComplex(x,
-                                xcurr, xnext,
-                                ycurr, ynext);
+    if (_xs.empty() || !inRange(x)) {
+      return _out_of_range;
     }
+    
+    cursor = findKey(x, cursor);
+    return interpolate(x, cursor);
   }
   
-  // Never reached because of program logic. This is here to avoid
-  // compiler errors:
-  return yvec.back();
-}
+  
+  // Evaluates at n arbitrary points
+  void evaluate(const double *x, T *y, size_t n) const {
+    size_t cursor = 0;
+    for (size_t i = 0; i < n; i++) {
+      y[i] = (*this)(x[i], cursor);
+    }
+  }
+  
+  // Evaluates at x0, x0 + dx, ..., x0 + (n-1) dx (e.g. a whole buffer of audio
+  // samples), walking the keys once instead of searching for each point.
+  void evaluateUniform(double x0, double dx, T *y, size_t n) const {
+    
+    assert(dx > 0);
+    
+    if (_xs.empty()) {
+      std::fill(y, y + n, _out_of_range);
+      return;
+    }
+    
+    size_t i = 0;
+    for (size_t s = 0; s < n; s++) {
+      double x = x0 + s * dx;
+      
+      if (!inRange(x)) {
+        y[s] = _out_of_range;
+        continue;
+      }
+      
+      while (_xs[i] < x) i++;
+      y[s] = interpolate(x, i);
+    }
+  }
+  
+  
+private:
+  
+  InterpolationMode _mode;
+  T _out_of_range;
+  
+  std::vector<double> _xs;
+  std::vector<T> _ys;
+  
+  // Hermite slopes at each key (unused in INTERP_LINEAR mode)
+  std::vector<T> _slopes;
+  
+  
+  // False for NaN, which would otherwise reach the key search
+  bool inRange(double x) const {
+    return x >= _xs[0] && x <= _xs.back();
+  }
+  
+  // Index of the first key >= x, for x within [first key, last key]. Checks
+  // the interval of the cursor and the one after it before falling back to a
+  // binary search.
+  size_t findKey(double x, size_t cursor) const {
+    
+    for (size_t i = cursor; i < cursor + 2 && i < _xs.size(); i++) {
+      if (x <= _xs[i] && (i == 0 || _xs[i - 1] < x)) {
+        return i;
+      }
+    }
+    
+    return std::lower_bound(_xs.begin(), _xs.end(), x) - _xs.begin();
+  }
+  
+  // i is the first key >= x
+  T interpolate(double x, size_t i) const {
+    
+    if (x == _xs[i])
+      return _ys[i];
+    
+    double x0 = _xs[i - 1];
+    double h = _xs[i] - x0;
+    double t = (x - x0) / h;
+    
+    if (_mode == INTERP_LINEAR) {
+      return _ys[i - 1] * (1 - t) + _ys[i] * t;
+    }
+    
+    double t2 = t * t;
+    double omt2 = (1 - t) * (1 - t);
+    
+    return _ys[i - 1] * ((1 + 2 * t) * omt2)
+         + _slopes[i - 1] * (h * t * omt2)
+         + _ys[i] * (t2 * (3 - 2 * t))
+         + _slopes[i] * (h * t2 * (t - 1));
+  }
+  
+  T secant(size_t i) const {
+    double h = _xs[i + 1] - _xs[i];
+    return h > 0 ? (_ys[i + 1] - _ys[i]) / h : T(0);
+  }
+  
+  // The slope at key i depends on keys i - 1, i and i + 1
+  void updateSlope(size_t i) {
+    
+    size_t n = _xs.size();
+    
+    if (_mode == INTERP_LINEAR || n < 2) {
+      _slopes[i] = T(0);
+    } else if (i == 0) {
+      _slopes[i] = secant(0);
+    } else if (i == n - 1) {
+      _slopes[i] = secant(n - 2);
+    } else if (_mode == INTERP_CUBIC) {
+      double h = _xs[i + 1] - _xs[i - 1];
+      _slopes[i] = h > 0 ? (_ys[i + 1] - _ys[i - 1]) / h : T(0);
+    } else {
+      _slopes[i] = monotoneSlope(secant(i - 1), secant(i),
+                                 _xs[i] - _xs[i - 1], _xs[i + 1] - _xs[i]);
+    }
+  }
+};
 
 #endif
@@ -0,0 +1,55 @@
+//
+//  ParallelFor.h
+//  aletler
+//
+//  Minimal fork/join helper on top of std::thread. The range is split into
+//  contiguous chunks with a fixed assignment, so anything that only writes
+//  to its own part of the range produces the same output on every run.
+//
+
+#ifndef aletler_ParallelFor_h
+#define aletler_ParallelFor_h
+
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+
+inline size_t defaultThreadCount() {
+  size_t n = std::thread::hardware_concurrency();
+  return n > 0 ? n : 1;
+}
+
+
+// Calls fn(begin, end) on disjoint chunks covering [0, n). At most nthreads
+// chunks are run concurrently (0 means one per core); the calling thread
+// takes the first chunk itself.
+template <typename Fn>
+inline void parallelFor(size_t n, Fn fn, size_t nthreads = 0) {
+
+  if (nthreads == 0) {
+    nthreads = defaultThreadCount();
+  }
+  nthreads = std::min(nthreads, n);
+
+  if (nthreads <= 1) {
+    if (n > 0) fn(size_t(0), n);
+    return;
+  }
+
+  size_t chunk = (n + nthreads - 1) / nthreads;
+
+  std::vector<std::thread> workers;
+  for (size_t begin = chunk; begin < n; begin += chunk) {
+    workers.push_back(std::thread(fn, begin, std::min(begin + chunk, n)));
+  }
+
+  fn(size_t(0), std::min(chunk, n));
+
+  for (size_t i = 0; i < workers.size(); i++) {
+    workers[i].join();
+  }
+}
+
+
+#endif
@@ -0,0 +1,99 @@
+//
+//  SpscQueue.h
+//  aletler
+//
+//  Bounded lock-free queue between exactly one producer thread and one
+//  consumer thread, e.g. a simulation thread feeding an audio callback.
+//  All the storage is allocated up front, and push / front / pop never
+//  block, lock or allocate, so the consumer can be a real-time thread.
+//
+//  Each side owns one index (the producer the tail, the consumer the head)
+//  and only reads the other's, so one acquire load and one release store per
+//  operation is all the synchronization needed. The two indices sit on
+//  separate cache lines so that the threads don't keep stealing one line
+//  from each other.
+//
+
+#ifndef aletler_SpscQueue_h
+#define aletler_SpscQueue_h
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+// Assumed cache line size (bytes) for keeping the two indices apart
+#define SPSC_CACHE_LINE 64
+
+
+template <typename T>
+class SpscQueue {
+
+public:
+
+  // Room for at least capacity elements (rounded up to a power of two)
+  SpscQueue(size_t capacity = 1024) : _head(0), _tail(0) {
+    size_t size = 1;
+    while (size < capacity + 1) size *= 2;
+    _slots.resize(size);
+    _mask = size - 1;
+  }
+
+  // Producer side. Returns false (and drops x) if the queue is full.
+  bool push(const T &x) {
+    size_t tail = _tail.load(std::memory_order_relaxed);
+    size_t next = (tail + 1) & _mask;
+    if (next == _head.load(std::memory_order_acquire)) return false;
+    _slots[tail] = x;
+    _tail.store(next, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side: the oldest element, or NULL if the queue is empty. It
+  // stays valid (and in the queue) until pop.
+  const T *front() const {
+    size_t head = _head.load(std::memory_order_relaxed);
+    if (head == _tail.load(std::memory_order_acquire)) return NULL;
+    return &_slots[head];
+  }
+
+  // Consumer side: removes the element returned by front
+  void pop() {
+    size_t head = _head.load(std::memory_order_relaxed);
+    _head.store((head + 1) & _mask, std::memory_order_release);
+  }
+
+  // Consumer side: pops the oldest element into x, or returns false if empty
+  bool pop(T &x) {
+    const T *f = front();
+    if (!f) return false;
+    x = *f;
+    pop();
+    return true;
+  }
+
+  // Number of elements queued; exact only when called from one of the two
+  // threads while the other one is idle
+  size_t size() const {
+    size_t head = _head.load(std::memory_order_acquire);
+    size_t tail = _tail.load(std::memory_order_acquire);
+    return (tail - head) & _mask;
+  }
+
+  bool empty() const { return size() == 0; }
+
+  size_t capacity() const { return _mask; }
+
+private:
+
+  SpscQueue(const SpscQueue &);
+  SpscQueue &operator=(const SpscQueue &);
+
+  std::vector<T> _slots;
+  size_t _mask;
+
+  alignas(SPSC_CACHE_LINE) std::atomic<size_t> _head;
+  alignas(SPSC_CACHE_LINE) std::atomic<size_t> _tail;
+};
+
+
+#endif
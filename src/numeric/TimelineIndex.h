@@ -0,0 +1,203 @@
+//
+//  TimelineIndex.h
+//  aletler
+//
+//  Finds the sources (bubbles, oscillators, ...) that are alive during a
+//  window of time. Each source is a closed interval [begin, end], and the
+//  index is a static centered interval tree: every node keeps the intervals
+//  that contain its center, sorted by begin and by end, and the intervals
+//  entirely before / after the center go to its children. The center of a
+//  node is the begin of one of its intervals, so no node is empty, and a
+//  query costs O(log n + k) for k results.
+//
+//  T is the time type, e.g. double for seconds or size_t for sample indices.
+//
+
+#ifndef aletler_TimelineIndex_h
+#define aletler_TimelineIndex_h
+
+#include <vector>
+#include <algorithm>
+#include <cassert>
+
+
+template <typename T>
+class TimelineIndex {
+
+public:
+
+  TimelineIndex() : _root(NO_NODE), _built(true) {}
+
+  void clear() {
+    _intervals.clear();
+    _nodes.clear();
+    _byBegin.clear();
+    _byEnd.clear();
+    _root = NO_NODE;
+    _built = true;
+  }
+
+  // Adds source id, alive from begin to end (inclusive, so begin <= end).
+  // build() must be called before the next query.
+  void add(size_t id, T begin, T end) {
+    assert(!(end < begin));
+    Interval iv;
+    iv.id = id;
+    iv.begin = begin;
+    iv.end = end;
+    _intervals.push_back(iv);
+    _built = false;
+  }
+
+  void build() {
+
+    _nodes.clear();
+    _byBegin.clear();
+    _byEnd.clear();
+
+    std::vector<size_t> all(_intervals.size());
+    for (size_t i = 0; i < all.size(); i++) all[i] = i;
+    std::sort(all.begin(), all.end(), BeginOrder(_intervals));
+
+    _root = buildNode(all);
+    _built = true;
+  }
+
+  size_t size() const { return _intervals.size(); }
+  bool empty() const { return _intervals.empty(); }
+
+  // Appends the ids of all the sources alive at some point in [t0, t1]
+  void query(T t0, T t1, std::vector<size_t> &ids) const {
+    assert(_built);
+    if (t1 < t0) return;
+    queryNode(_root, t0, t1, ids);
+  }
+
+  // Same, but replaces the contents of ids and sorts them, so that callers
+  // that sum over the result do so in a fixed order
+  void querySorted(T t0, T t1, std::vector<size_t> &ids) const {
+    ids.clear();
+    query(t0, t1, ids);
+    std::sort(ids.begin(), ids.end());
+  }
+
+
+private:
+
+  static const size_t NO_NODE = size_t(-1);
+
+  struct Interval {
+    size_t id;
+    T begin, end;
+  };
+
+  struct Node {
+    T center;
+
+    // the intervals containing center are _byBegin[first .. first + count)
+    // (by increasing begin) and _byEnd[first .. first + count) (by
+    // decreasing end)
+    size_t first, count;
+
+    size_t left, right;
+  };
+
+  struct BeginOrder {
+    BeginOrder(const std::vector<Interval> &ivs) : _ivs(ivs) {}
+    bool operator()(size_t a, size_t b) const {
+      if (_ivs[a].begin != _ivs[b].begin) return _ivs[a].begin < _ivs[b].begin;
+      return a < b;
+    }
+    const std::vector<Interval> &_ivs;
+  };
+
+  struct EndOrderDescending {
+    EndOrderDescending(const std::vector<Interval> &ivs) : _ivs(ivs) {}
+    bool operator()(size_t a, size_t b) const {
+      if (_ivs[a].end != _ivs[b].end) return _ivs[a].end > _ivs[b].end;
+      return a < b;
+    }
+    const std::vector<Interval> &_ivs;
+  };
+
+  std::vector<Interval> _intervals;
+  std::vector<Node> _nodes;
+  std::vector<size_t> _byBegin, _byEnd;
+  size_t _root;
+  bool _built;
+
+
+  // ivs is sorted by begin
+  size_t buildNode(const std::vector<size_t> &ivs) {
+
+    if (ivs.empty()) return NO_NODE;
+
+    T center = _intervals[ivs[ivs.size() / 2]].begin;
+
+    std::vector<size_t> before, here, after;
+    for (size_t i = 0; i < ivs.size(); i++) {
+      const Interval &iv = _intervals[ivs[i]];
+      if (iv.end < center) {
+        before.push_back(ivs[i]);
+      } else if (center < iv.begin) {
+        after.push_back(ivs[i]);
+      } else {
+        here.push_back(ivs[i]);
+      }
+    }
+
+    size_t n = _nodes.size();
+    _nodes.push_back(Node());
+    _nodes[n].center = center;
+    _nodes[n].first = _byBegin.size();
+    _nodes[n].count = here.size();
+
+    _byBegin.insert(_byBegin.end(), here.begin(), here.end());
+    std::sort(here.begin(), here.end(), EndOrderDescending(_intervals));
+    _byEnd.insert(_byEnd.end(), here.begin(), here.end());
+
+    size_t left = buildNode(before);
+    size_t right = buildNode(after);
+    _nodes[n].left = left;
+    _nodes[n].right = right;
+
+    return n;
+  }
+
+
+  void queryNode(size_t n, T t0, T t1, std::vector<size_t> &ids) const {
+
+    while (n != NO_NODE) {
+
+      const Node &node = _nodes[n];
+      const size_t *byBegin = &_byBegin[node.first];
+      const size_t *byEnd = &_byEnd[node.first];
+
+      if (t1 < node.center) {
+        // window is left of the center: every interval here ends after it,
+        // so only the ones beginning in time are alive
+        for (size_t i = 0; i < node.count && !(t1 < _intervals[byBegin[i]].begin); i++) {
+          ids.push_back(_intervals[byBegin[i]].id);
+        }
+        n = node.left;
+
+      } else if (node.center < t0) {
+        for (size_t i = 0; i < node.count && !(_intervals[byEnd[i]].end < t0); i++) {
+          ids.push_back(_intervals[byEnd[i]].id);
+        }
+        n = node.right;
+
+      } else {
+        // center is inside the window
+        for (size_t i = 0; i < node.count; i++) {
+          ids.push_back(_intervals[byBegin[i]].id);
+        }
+        queryNode(node.left, t0, t1, ids);
+        n = node.right;
+      }
+    }
+  }
+};
+
+
+#endif
@@ -13,6 +13,8 @@
 #include <sstream>
 #include <string>
 #include <io/FileStringParsers.h>
+#include <numeric/DampedOscillator.h>
+#include <algorithm>
 
 using namespace boost::numeric::odeint;
 typedef boost::array< double , 3 > state_type;
@@ -20,11 +22,6 @@ typedef boost::array< double , 3 > state_type;
 using namespace PhysicalConstants;
 
 
-static std::vector<double> *g_samples = NULL;
-static SoundFrequency *g_soundfreq = NULL;
-static double g_r0 = 0;
-
-
 static double forcingfn(double t) {
   
   // TURN IT OFF
@@ -39,19 +36,13 @@ static double forcingfn(double t) {
 }
 
 
-static double omega(double t) {
+// Radiative, viscous and thermal damping of a bubble of radius r0
+// vibrating at omg (the beta in x'' + beta x' + omg^2 x = 0)
+static double vibrationDamping(double omg, double r0) {
   
-  return g_soundfreq->frequencyAt(t, FREQ_OMEGA);
-}
-
-static void rhs( const state_type &x , state_type &dxdt ,  double t )
-{
+  double drad = omg * r0 / Sound::C_WATER;
   
-  double omg = omega(t);
-  
-  double drad = omg * g_r0 / Sound::C_WATER;
-  
-  double dvis = 4 * Fluids::MU_WATER / (Fluids::RHO_WATER * omg * g_r0*g_r0);
+  double dvis = 4 * Fluids::MU_WATER / (Fluids::RHO_WATER * omg * r0*r0);
   
   
   
@@ -61,15 +52,43 @@ static void rhs( const state_type &x , state_type &dxdt ,  double t )
   
   double delta = drad + dvis + dth;
   
-  double damping = omg * delta / sqrt(delta*delta + 4);
-  
-  dxdt[0] = x[1];
-  dxdt[1] = forcingfn(t) - omg * omg * x[0] - damping*x[1];
+  return omg * delta / sqrt(delta*delta + 4);
 }
 
-static void store_samples( const state_type &x , const double t ) {
-  g_samples->push_back(x[0]);
-}
+
+// odeint system for one bubble. It carries its own state (instead of going
+// through globals) so that several bubbles can be integrated at once.
+struct VibrationSystem {
+  
+  VibrationSystem(const SoundFrequency &soundfreq, double r0)
+  : _soundfreq(soundfreq), _r0(r0) {}
+  
+  void operator()( const state_type &x , state_type &dxdt ,  double t ) const
+  {
+    
+    double omg = _soundfreq.frequencyAt(t, FREQ_OMEGA);
+    
+    double damping = vibrationDamping(omg, _r0);
+    
+    dxdt[0] = x[1];
+    dxdt[1] = forcingfn(t) - omg * omg * x[0] - damping*x[1];
+  }
+  
+  const SoundFrequency &_soundfreq;
+  double _r0;
+};
+
+
+struct SampleObserver {
+  
+  SampleObserver(std::vector<double> &samples) : _samples(samples) {}
+  
+  void operator()( const state_type &x , const double t ) const {
+    _samples.push_back(x[0]);
+  }
+  
+  std::vector<double> &_samples;
+};
 
 
 double Bubble::frequency_omega(double capacitance) const {
@@ -87,7 +106,7 @@ double Bubble::frequency_omega(double capacitance) const {
 }
 
 
-void Bubble::integrateVibrationODE() {
+void Bubble::integrateVibrationODE(VibrationIntegrator method) {
   
   // nothing to integrate...
   if (_soundfreq.isEmpty())
@@ -95,29 +114,97 @@ void Bubble::integrateVibrationODE() {
   
   double timeStep = 1.0 / Sound::SAMPLING_RATE;
   
-  // temporarily store the address in a global var so the callback can access it
-  g_samples = &_samples;
-  g_soundfreq = &_soundfreq;
-  g_r0 = _r0;
+  if (method == VIB_EXACT_STEP) {
+    
+    // The exact step takes omega piecewise linear. In the Hermite modes the
+    // curve is sampled every VIB_RESAMPLE_STEPS audio samples, which is
+    // much finer than its keyframes, and is linear in between.
+    std::vector<double> resampledTimes, resampledOmegas;
+    const std::vector<double> *times = &_soundfreq.times();
+    const std::vector<double> *omegaKeys = &_soundfreq.omegas();
+    
+    if (_soundfreq.interpolationMode() != INTERP_LINEAR) {
+      for (size_t k = 0; k + 1 < times->size(); k++) {
+        double t0 = (*times)[k], t1 = (*times)[k + 1];
+        size_t pieces = std::max(1.0, ceil((t1 - t0) / (VIB_RESAMPLE_STEPS * timeStep)));
+        for (size_t j = 0; j < pieces; j++) {
+          double t = t0 + (t1 - t0) * j / pieces;
+          resampledTimes.push_back(t);
+          resampledOmegas.push_back(_soundfreq.frequencyAt(t, FREQ_OMEGA));
+        }
+      }
+      resampledTimes.push_back(times->back());
+      resampledOmegas.push_back(omegaKeys->back());
+      times = &resampledTimes;
+      omegaKeys = &resampledOmegas;
+    }
+    
+    // The damping only depends on omega, so evaluate it once per key
+    // and interpolate it along with omega
+    const std::vector<double> &omegas = *omegaKeys;
+    std::vector<double> betas(omegas.size());
+    for (size_t k = 0; k < omegas.size(); k++) {
+      betas[k] = omegas[k] > 0 ? vibrationDamping(omegas[k], _r0) : 0;
+    }
+    
+    size_t nsteps = numConstSteps(_soundfreq.startTime(), _soundfreq.stopTime(), timeStep);
+    _samples.resize(nsteps + 1);
+    
+    integrateDampedOscillator(*times, omegas, betas,
+                              _soundfreq.startTime(), timeStep, nsteps,
+                              0.0, -1.0,
+                              &_samples[0]);
+    
+    sample0 = floor(_soundfreq.startTime() * Sound::SAMPLING_RATE);
+    samplef = sample0 + _samples.size() - 1;
+    return;
+  }
+  
+  _samples.clear();
   
   runge_kutta4< state_type > stepper;
   state_type initcondits = { 0.0, -1.0 };
   integrate_const(stepper,
-                  rhs,
+                  VibrationSystem(_soundfreq, _r0),
                   initcondits,
                   _soundfreq.startTime(), _soundfreq.stopTime(),
                   timeStep,
-                  store_samples );
-  
-  // no pointers left behind!
-  g_samples = NULL;
-  g_soundfreq = NULL;
+                  SampleObserver(_samples) );
   
   sample0 = floor(_soundfreq.startTime() * Sound::SAMPLING_RATE);
   samplef = sample0 + _samples.size() - 1;
 }
 
 
+bool Bubble::vibrationRange(size_t &first, size_t &count) const {
+  
+  if (_soundfreq.isEmpty()) return false;
+  
+  double timeStep = 1.0 / Sound::SAMPLING_RATE;
+  first = floor(_soundfreq.startTime() * Sound::SAMPLING_RATE);
+  count = numConstSteps(_soundfreq.startTime(), _soundfreq.stopTime(), timeStep) + 1;
+  return true;
+}
+
+
+void Bubble::vibrationAt(double sample, double &omega, double &beta, double &scale) {
+  
+  // integrateVibrationODE's clock starts at startTime() on sample0, and
+  // holds the end frequencies outside the keyframes
+  double t = _soundfreq.startTime()
+           + (sample - floor(_soundfreq.startTime() * Sound::SAMPLING_RATE)) / Sound::SAMPLING_RATE;
+  t = std::min(std::max(t, _soundfreq.startTime()), _soundfreq.stopTime());
+  
+  omega = _soundfreq.frequencyAt(t, FREQ_OMEGA);
+  beta = omega > 0 ? vibrationDamping(omega, _r0) : 0;
+  // held at the ends too, so that a block that starts before the bubble
+  // does not pick up the zero outside its keyframes
+  double ts = sample / Sound::SAMPLING_RATE;
+  ts = std::min(std::max(ts, _soundfreq.startTime()), _soundfreq.stopTime());
+  scale = getPressureScale(ts);
+}
+
+
 void Bubble::setBubbleMesh(TriangleMesh *b) {
   _bubble = b;
   double bubbleVolume = _bubble->volume();
@@ -150,6 +237,29 @@ double Bubble::getSample(size_t sampleIndex) {
 }
 
 
+void Bubble::addSamples(double *out, size_t firstSample, size_t n) {
+  if (_soundfreq.isEmpty() || _samples.empty()) return;
+  
+  size_t begin = std::max(firstSample, sample0);
+  size_t end = std::min(firstSample + n, sample0 + _samples.size());
+  if (begin >= end) return;
+  
+  size_t len = end - begin;
+  double dt = 1.0 / (double)( Sound::SAMPLING_RATE );
+  
+  _scaleBuffer.resize(len);
+  _cpressureScales.evaluateUniform(begin / (double)( Sound::SAMPLING_RATE ), dt, &_scaleBuffer[0], len);
+  
+  const double *x = &_samples[begin - sample0];
+  double *y = out + (begin - firstSample);
+  
+  for (size_t i = 0; i < len; i++) {
+    const std::complex<double> &c = _scaleBuffer[i];
+    y[i] += x[i] * sqrt(c.real() * c.real() + c.imag() * c.imag());
+  }
+}
+
+
 void Bubble::saveBubbleFrequencyFile() const {
   std::string filename = bubbleFreqFilename("/Users/phaedon/github/aletler/meshes/geomsim3/", "bubblefreqs", _bubble_index);
   
@@ -264,11 +374,10 @@ void Bubble::loadExternalSolverFiles(const std::string &weightFilename,
   ifileVel.close();
   
   std::cout << "pressure: " << std::abs(pressure) << std::endl;
-  _cpressureScales.push_back(pressure);
-  _pressureTimes.push_back(timestamp);
+  _cpressureScales.addKey(timestamp, pressure);
 }
 
 
 double Bubble::getPressureScale(double time) {
-  return std::abs(interpLinearComplexVectors(time, _pressureTimes, _cpressureScales));
+  return std::abs(_cpressureScales(time));
 }
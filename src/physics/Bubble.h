@@ -15,6 +15,21 @@
 #include <geometry/TriangleMesh.h>
 #include <sound/SoundFrequency.h>
 
+// Audio samples between the points at which VIB_EXACT_STEP samples a
+// frequency curve that is not piecewise linear
+#define VIB_RESAMPLE_STEPS 8
+
+enum VibrationIntegrator {
+  // exact damped oscillator step per audio sample, with omega and damping
+  // interpolated between keyframes (see numeric/DampedOscillator.h). Honours
+  // the interpolation mode of the frequencies: the Hermite modes are sampled
+  // every VIB_RESAMPLE_STEPS audio samples and interpolated linearly.
+  VIB_EXACT_STEP,
+  
+  // boost::odeint runge_kutta4, evaluating omega and damping at every stage
+  VIB_RK4
+};
+
 class Bubble {
   
 public:
@@ -38,9 +53,27 @@ public:
   
   double frequency_omega(double capacitance) const;
   void setBubbleMesh(TriangleMesh *b);
-  void integrateVibrationODE();
+  void integrateVibrationODE(VibrationIntegrator method = VIB_EXACT_STEP);
   double getSample(size_t sampleIndex);
   
+  // Adds samples firstSample .. firstSample + n - 1 of this bubble, scaled by
+  // the pressure scale, to out[0 .. n-1]
+  void addSamples(double *out, size_t firstSample, size_t n);
+  
+  // The samples integrateVibrationODE would fill (first, first + count - 1),
+  // without integrating. False if the bubble has no frequencies.
+  bool vibrationRange(size_t &first, size_t &count) const;
+  
+  // Frequency (rad/s) and damping of the bubble's oscillator, and its
+  // pressure scale, at sample index 'sample' (which may be fractional),
+  // for renderers that step the oscillator themselves (Fluid::mixdownBank)
+  void vibrationAt(double sample, double &omega, double &beta, double &scale);
+  
+  // The range of samples filled in by integrateVibrationODE
+  bool hasSamples() const { return !_samples.empty(); }
+  size_t firstSample() const { return sample0; }
+  size_t lastSample() const { return samplef; }
+  
   
   TriangleMesh *getBubbleMesh() {
     return _bubble;
@@ -78,6 +111,9 @@ private:
   
   std::vector<double> _samples;
   
+  // scratch space for the pressure scales of one block in addSamples
+  std::vector<std::complex<double> > _scaleBuffer;
+  
   SoundFrequency _soundfreq;
   TriangleMesh *_bubble;
   
@@ -85,8 +121,7 @@ private:
   size_t _animFrameRate;
   
   //std::vector<size_t> _pressureFrames;
-  std::vector<double> _pressureTimes;
-  std::vector<std::complex<double> > _cpressureScales;
+  KeyframeInterpolator<std::complex<double> > _cpressureScales;
   
   Vector3d _vel;
   Vector3d _accel;
@@ -8,6 +8,7 @@
 
 
 #include <physics/Electrostatics.h>
+#include <numeric/ParallelFor.h>
 #include <vdb.h>
 
 using Eigen::Vector3d;
@@ -27,6 +28,113 @@ static double dirichletMatrixEntry(const Vector3d &yi, const Vector3d &xj, const
 }
 
 
+// The quadrature points of all the bubble panels, flattened into arrays so that
+// the field kernel below streams through them. The weights already include the
+// panel area, the 1/4pi, and the density (x_i for the single layer, 1 for the
+// double layer), using the same rules as dirichletMatrixElem / neumannMatrixElem.
+struct FieldSources {
+  
+  // single layer (GAUSS4X4)
+  std::vector<double> sx, sy, sz, sw;
+  
+  // double layer (STRANG3), with unit normals
+  std::vector<double> dx, dy, dz, dw, nx, ny, nz;
+  
+  // far field moments about center
+  Vector3d center;
+  double radius;
+  double charge;
+  Vector3d dipole;
+  
+  FieldSources(const TriangleMesh *bubble, const VectorXd &sigma) {
+    
+    size_t nb = bubble->size();
+    
+    center.setZero();
+    for (size_t i = 0; i < nb; i++) {
+      center += bubble->triangle(i).centroid();
+    }
+    center /= double(nb);
+    
+    radius = 0;
+    charge = 0;
+    dipole.setZero();
+    
+    for (size_t i = 0; i < nb; i++) {
+      Triangle t = bubble->triangle(i);
+      double area = t.area();
+      Vector3d n = t.normal().normalized();
+      
+      radius = std::max(radius, (t.a - center).norm());
+      radius = std::max(radius, (t.b - center).norm());
+      radius = std::max(radius, (t.c - center).norm());
+      
+      for (size_t q = 0; q < 16; q++) {
+        const Vector2d &uv = gauss4x4_abscissas[q];
+        Vector3d y = (1 - uv.x() - uv.y()) * t.a + uv.x() * t.b + uv.y() * t.c;
+        double w = (0.25 * M_1_PI) * area * gauss4x4_weights[q] * sigma(i);
+        
+        sx.push_back(y.x()); sy.push_back(y.y()); sz.push_back(y.z());
+        sw.push_back(w);
+        
+        charge += w;
+        dipole += w * (y - center);
+      }
+      
+      for (size_t q = 0; q < 4; q++) {
+        const Vector2d &uv = strang3_abscissas[q];
+        Vector3d y = (1 - uv.x() - uv.y()) * t.a + uv.x() * t.b + uv.y() * t.c;
+        double w = (0.25 * M_1_PI) * area * strang3_weights[q];
+        
+        dx.push_back(y.x()); dy.push_back(y.y()); dz.push_back(y.z());
+        dw.push_back(w);
+        nx.push_back(n.x()); ny.push_back(n.y()); nz.push_back(n.z());
+        
+        // The double layer of a closed surface has no monopole; its
+        // leading term acts like an extra dipole
+        dipole -= w * n;
+      }
+    }
+  }
+  
+  double farField(const Vector3d &p) const {
+    Vector3d r = p - center;
+    double d = r.norm();
+    return charge / d + dipole.dot(r) / (d * d * d);
+  }
+};
+
+
+// Adds the field of all the sources to acc[0..np). The loops run over the
+// points innermost so that they vectorize without reordering any sums.
+static void accumulateField(const FieldSources &src,
+                            const double *px, const double *py, const double *pz,
+                            double *acc, size_t np) {
+  
+  for (size_t q = 0; q < src.sw.size(); q++) {
+    double sx = src.sx[q], sy = src.sy[q], sz = src.sz[q], w = src.sw[q];
+    
+    for (size_t p = 0; p < np; p++) {
+      double rx = sx - px[p], ry = sy - py[p], rz = sz - pz[p];
+      acc[p] += w / sqrt(rx*rx + ry*ry + rz*rz);
+    }
+  }
+  
+  for (size_t q = 0; q < src.dw.size(); q++) {
+    double sx = src.dx[q], sy = src.dy[q], sz = src.dz[q], w = src.dw[q];
+    double nx = src.nx[q], ny = src.ny[q], nz = src.nz[q];
+    
+    for (size_t p = 0; p < np; p++) {
+      double rx = sx - px[p], ry = sy - py[p], rz = sz - pz[p];
+      double r2 = rx*rx + ry*ry + rz*rz;
+      acc[p] += w * (rx*nx + ry*ny + rz*nz) / (r2 * sqrt(r2));
+    }
+  }
+}
+
+static const size_t FIELD_TILE = 256;
+
+
 /**********************
  *   PUBLIC METHODS
  **********************/
@@ -41,6 +149,117 @@ void Electrostatics::setBubble(TriangleMesh *b) {
 }
 
 
+void Electrostatics::setBubble(TriangleMesh *b, size_t bubbleIndex) {
+  _bubble = b;
+  _nb = _bubble->size();
+  
+  BubbleCache &cache = bubbleCache(bubbleIndex);
+  
+  if (isRigidTranslation(cache, _bubble)) {
+    computeRHS(&cache.Hbb);
+    computeBubbleSubmatrices(&cache.Abb);
+    
+    if (cache.hasLU) {
+      fmbsolver.setBubbleMatrices(_Abb, cache.AbbLU, _B, _C);
+      return;
+    }
+    fmbsolver.setBubbleMatrices(_Abb, _B, _C);
+  } else {
+    computeRHS();
+    computeBubbleSubmatrices();
+    
+    fmbsolver.setBubbleMatrices(_Abb, _B, _C);
+    storeBubbleCache(cache, _bubble, _Abb, _Hb.topRows(_nb));
+  }
+  
+  cache.AbbLU = fmbsolver.bubbleLU();
+  cache.hasLU = true;
+}
+
+
+void Electrostatics::setBubbles(const std::vector<TriangleMesh *> &bubbles,
+                                const std::vector<size_t> &bubbleIndices) {
+  
+  assert(bubbles.size() == bubbleIndices.size());
+  
+  // _Abb, _Hb and _x no longer belong to a single bubble
+  _bubble = NULL;
+  _nb = 0;
+  
+  _bubbles = bubbles;
+  size_t nbub = _bubbles.size();
+  
+  _bubbleOffsets.resize(nbub + 1);
+  _bubbleOffsets[0] = 0;
+  for (size_t i = 0; i < nbub; i++) {
+    _bubbleOffsets[i + 1] = _bubbleOffsets[i] + _bubbles[i]->size();
+  }
+  
+  size_t nbt = _bubbleOffsets[nbub];
+  size_t nd = _na + _ns;
+  
+  _Abb.setZero(nbt, nbt);
+  _B.resize(nbt, nd);
+  _C.resize(nd, nbt);
+  _rhsMulti.setZero(nbt + nd, nbub);
+  
+  std::vector<BoundingBox> boxes(nbub);
+  for (size_t i = 0; i < nbub; i++) {
+    _bubbles[i]->getBoundingBox(boxes[i]);
+  }
+  
+  MatrixXd blk, Abbi, Hbbi;
+  
+  for (size_t i = 0; i < nbub; i++) {
+    TriangleMesh *bub = _bubbles[i];
+    size_t off = _bubbleOffsets[i];
+    size_t ni = bub->size();
+    
+    // Diagonal blocks: reuse those of bubbles that have only translated
+    BubbleCache &cache = bubbleCache(bubbleIndices[i]);
+    
+    if (!isRigidTranslation(cache, bub)) {
+      dirichletBlock(bub, bub, Abbi);
+      neumannBlock(bub, bub, Hbbi);
+      storeBubbleCache(cache, bub, Abbi, Hbbi);
+      cache.hasLU = false;
+    }
+    _Abb.block(off, off, ni, ni) = cache.Abb;
+    _rhsMulti.block(off, i, ni, 1) = cache.Hbb.rowwise().sum();
+    
+    // Near-field coupling with the other bubbles
+    // (touching boxes are at distance 0, so zero has to be special-cased)
+    for (size_t j = 0; j < nbub && _couplingDistance > 0; j++) {
+      if (j == i || boxes[i].distance(boxes[j]) > _couplingDistance) continue;
+      
+      dirichletBlock(bub, _bubbles[j], blk);
+      _Abb.block(off, _bubbleOffsets[j], ni, blk.cols()) = blk;
+      
+      neumannBlock(bub, _bubbles[j], blk);
+      _rhsMulti.block(off, j, ni, 1) = blk.rowwise().sum();
+    }
+    
+    // Coupling with the domain
+    dirichletBlock(bub, _air, blk);
+    _B.block(off, 0, ni, _na) = blk;
+    neumannBlock(bub, _solid, blk);
+    _B.block(off, _na, ni, _ns) = blk;
+    
+    dirichletBlock(_air, bub, blk);
+    _C.block(0, off, _na, ni) = blk;
+    dirichletBlock(_solid, bub, blk);
+    _C.block(_na, off, _ns, ni) = blk;
+    
+    neumannBlock(_air, bub, blk);
+    _rhsMulti.block(nbt, i, _na, 1) = blk.rowwise().sum();
+    neumannBlock(_solid, bub, blk);
+    _rhsMulti.block(nbt + _na, i, _ns, 1) = blk.rowwise().sum();
+  }
+  
+  fmbsolver.setBubbleMatrices(_Abb, _B, _C);
+}
+
+
 void Electrostatics::setDomain(TriangleMesh *air, TriangleMesh *solid) {
   
   _air = air;
@@ -49,6 +268,9 @@ void Electrostatics::setDomain(TriangleMesh *air, TriangleMesh *solid) {
   _na = _air->size();
   _ns = _solid->size();
   
+  _frame++;
+  evictBubbleCache();
+  
   precomputeDomainMatrix();
   
   // This is one of the bottlenecks:
@@ -58,10 +280,10 @@ void Electrostatics::setDomain(TriangleMesh *air, TriangleMesh *solid) {
 
 double Electrostatics::evaluateField(const Vector3d &x) const {
   
-  size_t n = _nb + _na + _ns;
+  assert(_bubble && "evaluateField() needs setBubble(), not setBubbles()");
   
-  MatrixXd singleLayer(1, n);
-  MatrixXd doubleLayer(1, n);
+  MatrixXd singleLayer(1, _nb);
+  MatrixXd doubleLayer(1, _nb);
   
   for (size_t i = 0; i < _nb; i++) {
     
@@ -72,7 +294,54 @@ double Electrostatics::evaluateField(const Vector3d &x) const {
     
   }
   
-  return (-doubleLayer * _1_0_0 + singleLayer * _x)(0,0);
+  return (-doubleLayer * _1_0_0 + singleLayer * _x.head(_nb))(0,0);
+}
+
+
+void Electrostatics::evaluateField(const std::vector<Vector3d> &pts,
+                                   std::vector<double> &vals,
+                                   double farFieldRatio) const {
+  
+  assert(_bubble && "evaluateField() needs setBubble(), not setBubbles()");
+  
+  vals.resize(pts.size());
+  
+  const FieldSources src(_bubble, _x.head(_nb));
+  double farDist = farFieldRatio * src.radius;
+  
+  size_t ntiles = (pts.size() + FIELD_TILE - 1) / FIELD_TILE;
+  
+  parallelFor(ntiles, [&](size_t tbegin, size_t tend) {
+    
+    double px[FIELD_TILE], py[FIELD_TILE], pz[FIELD_TILE], acc[FIELD_TILE];
+    size_t idx[FIELD_TILE];
+    
+    for (size_t tile = tbegin; tile < tend; tile++) {
+      size_t begin = tile * FIELD_TILE;
+      size_t end = std::min(begin + FIELD_TILE, pts.size());
+      
+      // gather the near points of this tile; far ones are done right away
+      size_t np = 0;
+      for (size_t i = begin; i < end; i++) {
+        if (farFieldRatio > 0 && (pts[i] - src.center).norm() > farDist) {
+          vals[i] = src.farField(pts[i]);
+        } else {
+          px[np] = pts[i].x();
+          py[np] = pts[i].y();
+          pz[np] = pts[i].z();
+          acc[np] = 0;
+          idx[np] = i;
+          np++;
+        }
+      }
+      
+      accumulateField(src, px, py, pz, acc, np);
+      
+      for (size_t p = 0; p < np; p++) {
+        vals[idx[p]] = acc[p];
+      }
+    }
+  });
 }
 
 /**********************
@@ -80,6 +349,118 @@ double Electrostatics::evaluateField(const Vector3d &x) const {
  **********************/
 
 
+// Compares against the geometry for which the cached Abb was computed (not
+// merely the previous frame), so that small deformations cannot accumulate.
+bool Electrostatics::isRigidTranslation(const BubbleCache &cache, const TriangleMesh *b) const {
+  
+  size_t nb = b->size();
+  if (cache.verts.empty() || cache.verts.size() != 3 * nb) {
+    return false;
+  }
+  
+  double tol = _rigidTolerance * cache.extent;
+  Vector3d offset = b->triangle(0).a - cache.verts[0];
+  
+  for (size_t i = 0; i < nb; i++) {
+    Triangle t = b->triangle(i);
+    
+    if ((t.a - cache.verts[3*i] - offset).norm() > tol
+        || (t.b - cache.verts[3*i + 1] - offset).norm() > tol
+        || (t.c - cache.verts[3*i + 2] - offset).norm() > tol) {
+      return false;
+    }
+  }
+  
+  return true;
+}
+
+
+Electrostatics::BubbleCache &Electrostatics::bubbleCache(size_t bubbleIndex) {
+  
+  if (bubbleIndex >= _cache.size()) {
+    _cache.resize(bubbleIndex + 1);
+  }
+  _cache[bubbleIndex].frame = _frame;
+  return _cache[bubbleIndex];
+}
+
+
+// Bubbles come and go over a long simulation; without this, the matrices of
+// every bubble ever seen would be kept. An entry is only a few empty members
+// once freed, so the vector itself is not shrunk.
+void Electrostatics::evictBubbleCache() {
+  
+  for (size_t i = 0; i < _cache.size(); i++) {
+    if (_cache[i].frame + 1 < _frame && !_cache[i].verts.empty()) {
+      _cache[i] = BubbleCache();
+    }
+  }
+}
+
+
+// Records the geometry of b along with its own blocks Abb and Hbb (the
+// bubble rows of _Hb), as just assembled by the caller.
+void Electrostatics::storeBubbleCache(BubbleCache &cache, const TriangleMesh *b,
+                                      const MatrixXd &Abb, const MatrixXd &Hbb) {
+  
+  size_t nb = b->size();
+  cache.verts.resize(3 * nb);
+  
+  Vector3d boxmin, boxmax;
+  for (size_t i = 0; i < nb; i++) {
+    Triangle t = b->triangle(i);
+    cache.verts[3*i] = t.a;
+    cache.verts[3*i + 1] = t.b;
+    cache.verts[3*i + 2] = t.c;
+    
+    if (i == 0) {
+      boxmin = boxmax = t.a;
+    }
+    for (size_t k = 3*i; k < 3*i + 3; k++) {
+      boxmin = boxmin.cwiseMin(cache.verts[k]);
+      boxmax = boxmax.cwiseMax(cache.verts[k]);
+    }
+  }
+  cache.extent = (boxmax - boxmin).norm();
+  
+  cache.Abb = Abb;
+  cache.Hbb = Hbb;
+}
+
+
+void Electrostatics::dirichletBlock(const TriangleMesh *rows, const TriangleMesh *cols, MatrixXd &m) const {
+  
+  m.resize(rows->size(), cols->size());
+  
+  for (size_t r = 0; r < rows->size(); r++) {
+    Vector3d cent = rows->triangle(r).centroid();
+    
+    for (size_t c = 0; c < cols->size(); c++) {
+      Triangle tj = cols->triangle(c);
+      m(r, c) = (0.25 * M_1_PI) * tj.potential( cent );
+    }
+  }
+}
+
+
+void Electrostatics::neumannBlock(const TriangleMesh *rows, const TriangleMesh *cols, MatrixXd &m) const {
+  
+  m.resize(rows->size(), cols->size());
+  
+  for (size_t r = 0; r < rows->size(); r++) {
+    Vector3d cent = rows->triangle(r).centroid();
+    
+    for (size_t c = 0; c < cols->size(); c++) {
+      if (rows == cols && r == c) {
+        m(r, c) = +0.5;
+      } else {
+        m(r, c) = neumannMatrixElem(cols->triangle(c), cent);
+      }
+    }
+  }
+}
+
+
 
 
 double Electrostatics::dirichletMatrixElem(const Triangle &j, const Vector3d &xi) const {
@@ -154,15 +535,22 @@ void Electrostatics::precomputeDomainMatrix() {
 }
 
 
-void Electrostatics::computeBubbleSubmatrices() {
+void Electrostatics::computeBubbleSubmatrices(const MatrixXd *Abb) {
   size_t n = _nb + _na + _ns;
   
   _Abb.resize(_nb, _nb);
   _B.resize(_nb, _na + _ns);
   _C.resize(_na + _ns, _nb);
+  
+  // A translated bubble has the same Abb, so only C needs the left column
+  size_t r0 = 0;
+  if (Abb) {
+    _Abb = *Abb;
+    r0 = _nb;
+  }
 
   // Let's do the left column: Abb and C.
-  for (size_t r = 0; r < n; r++) {
+  for (size_t r = r0; r < n; r++) {
     Triangle ti = triangleAt(r);
     Vector3d cent = ti.centroid();
     
@@ -204,6 +592,8 @@ void Electrostatics::computeBubbleSubmatrices() {
 
 double Electrostatics::bubbleCapacitance(VectorXd &velAir) {
   
+  assert(_bubble && "bubbleCapacitance() needs setBubble(); see bubbleCapacitances()");
+  
   fmbsolver.solve(_rhs, _x);
   
   // Save the free surface velocities for later...
@@ -217,6 +607,23 @@ double Electrostatics::bubbleCapacitance(VectorXd &velAir) {
 
 
 
+void Electrostatics::bubbleCapacitances(std::vector<double> &caps, MatrixXd &velAir) {
+  
+  fmbsolver.solveMultiple(_rhsMulti, _xMulti);
+  
+  size_t nbub = _bubbles.size();
+  size_t nbt = _bubbleOffsets[nbub];
+  
+  velAir = _xMulti.block(nbt, 0, _na, nbub);
+  
+  caps.resize(nbub);
+  for (size_t i = 0; i < nbub; i++) {
+    size_t ni = _bubbles[i]->size();
+    caps[i] = _xMulti.block(_bubbleOffsets[i], i, ni, 1).col(0).dot(_bubbles[i]->triangleAreas()) * 0.25 * M_1_PI;
+  }
+}
+
+
 void Electrostatics::visualize() {
   
   
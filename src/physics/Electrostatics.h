@@ -2,13 +2,15 @@
 #define _aletler_electrostatics_h_
 
 #include <Eigen/Dense>
+#include <Eigen/LU>
 #include <geometry/TriangleMesh.h>
 #include <vector>
+#include <limits>
 #include <numeric/FastMultibubble.h>
 
 using Eigen::MatrixXd;
 using Eigen::VectorXd;
-
+using Eigen::FullPivLU;
 
 
 class Electrostatics {
@@ -18,18 +20,66 @@ class Electrostatics {
   Electrostatics() :
   _bubble(NULL),
   _air(NULL),
-  _solid(NULL)
+  _solid(NULL),
+  _rigidTolerance(1e-6),
+  _frame(0),
+  _couplingDistance(std::numeric_limits<double>::infinity())
   {}
   
   
   void setBubble(TriangleMesh *b);
+  
+  // Same as above, but remembers the bubble by its index across frames. If the
+  // bubble has only translated since its Abb block was last computed, then Abb
+  // (and its factorization) is reused and only the coupling blocks B, C are rebuilt.
+  // Each setDomain() starts a new frame, and drops what is remembered of the
+  // bubbles that were not set during the frame before it.
+  void setBubble(TriangleMesh *b, size_t bubbleIndex);
+  
+  // Largest vertex deviation from a pure translation, relative to the size of
+  // the bubble, for which the bubble is still treated as rigidly moved.
+  void setRigidMotionTolerance(double tol) { _rigidTolerance = tol; }
+
   void setDomain(TriangleMesh *air, TriangleMesh *solid);
   
   // The parameter velAir is an empty vector that is appropriately resized
   // to take the solved values of the velocity of the free surface
   double bubbleCapacitance(VectorXd &velAir);
+  
+  
+  // Multi-bubble mode: all the bubbles of a frame are assembled into one system
+  // against the shared (pre-factored) domain matrix, and solved together with a
+  // single Schur complement factorization. bubbleIndices identify the bubbles
+  // across frames, as in setBubble(b, bubbleIndex).
+  //
+  // The coupled system is dense over all the bubble elements within the
+  // coupling distance of each other, so with the default distance (every
+  // pair) its cost grows as the cube of the total; for clouds of bubbles,
+  // set a finite distance or use setBubble() one bubble at a time.
+  void setBubbles(const std::vector<TriangleMesh *> &bubbles,
+                  const std::vector<size_t> &bubbleIndices);
+  
+  // Bubbles whose bounding boxes are farther apart than this do not interact
+  // directly (only through the domain). Zero or less disables bubble-bubble
+  // coupling, even between touching bubbles; the default couples every pair.
+  void setBubbleCouplingDistance(double d) { _couplingDistance = d; }
+  
+  // One capacitance per bubble given to setBubbles(), and the corresponding
+  // free surface velocities in the columns of velAir.
+  void bubbleCapacitances(std::vector<double> &caps, MatrixXd &velAir);
 
+  // The field of the bubble given to the last setBubble(), after
+  // bubbleCapacitance(). Not available in multi-bubble mode: setBubbles()
+  // forgets the single bubble.
   double evaluateField(const Vector3d &x) const;
+  
+  // Batched version of the above: fills vals with the field at each point.
+  // Points are processed in tiles over all threads. Points farther from the
+  // bubble center than farFieldRatio bubble radii use a monopole + dipole
+  // approximation instead of the panel sums; zero disables it.
+  void evaluateField(const std::vector<Vector3d> &pts,
+                     std::vector<double> &vals,
+                     double farFieldRatio = 0) const;
   void visualize();
   
   
@@ -63,22 +113,86 @@ class Electrostatics {
   size_t _nb, _na, _ns;
   
   
+  // The parts of the system that depend only on the relative geometry of a
+  // bubble's own elements, and are therefore unchanged when it translates.
+  struct BubbleCache {
+    // triangle corners (a, b, c for each element) when Abb was computed
+    std::vector<Vector3d> verts;
+    double extent;
+    
+    MatrixXd Abb;
+    FullPivLU<MatrixXd> AbbLU;
+    
+    // the bubble rows of _Hb
+    MatrixXd Hbb;
+    
+    // the multi-bubble solve never needs the factorization, so it may be missing
+    bool hasLU;
+    
+    // the last frame in which the bubble was set
+    size_t frame;
+    
+    BubbleCache() : extent(0), hasLU(false), frame(0) {}
+  };
+  
+  std::vector<BubbleCache> _cache;
+  double _rigidTolerance;
+  
+  // Counts the setDomain() calls
+  size_t _frame;
+  
+  // The cache entry of bubbleIndex, marked as used in this frame
+  BubbleCache &bubbleCache(size_t bubbleIndex);
+  
+  // Frees the entries of the bubbles not set in the previous frame
+  void evictBubbleCache();
+  
+  bool isRigidTranslation(const BubbleCache &cache, const TriangleMesh *b) const;
+  void storeBubbleCache(BubbleCache &cache, const TriangleMesh *b,
+                        const MatrixXd &Abb, const MatrixXd &Hbb);
+  
+  
+  // State for the multi-bubble mode. Bubble i occupies rows/columns
+  // [_bubbleOffsets[i], _bubbleOffsets[i+1]) of the bubble blocks.
+  std::vector<TriangleMesh *> _bubbles;
+  std::vector<size_t> _bubbleOffsets;
+  double _couplingDistance;
+  
+  // One right-hand side (and solution) column per bubble
+  MatrixXd _rhsMulti;
+  MatrixXd _xMulti;
+  
+  // Single-layer elements of the triangles of cols, collocated at the centroids of rows
+  void dirichletBlock(const TriangleMesh *rows, const TriangleMesh *cols, MatrixXd &m) const;
+  
+  // Double-layer elements, with +1/2 on the diagonal when rows and cols are the same mesh
+  void neumannBlock(const TriangleMesh *rows, const TriangleMesh *cols, MatrixXd &m) const;
+  
   void precomputeDomainMatrix();
-  void computeBubbleSubmatrices();
+  
+  // If Abb is given, it is copied in place of recomputing the top-left block
+  void computeBubbleSubmatrices(const MatrixXd *Abb = NULL);
 
   double dirichletMatrixElem(const Triangle &j, const Vector3d &xi) const;
   double neumannMatrixElem(const Triangle &j, const Vector3d &xi) const;
   
 
-  void computeRHS() {
+  // If Hbb is given, it is copied in place of recomputing the bubble rows
+  void computeRHS(const MatrixXd *Hbb = NULL) {
     size_t n = _nb + _na + _ns;
     _Hb.resize(n, _nb);
     
     _1_0_0.resize(_nb);
     _1_0_0.setConstant(1.0);
     
+    size_t r0 = 0;
+    if (Hbb) {
+      _Hb.topRows(_nb) = *Hbb;
+      r0 = _nb;
+    }
+    
     // Compute this column block of Neumann elements
-    for (size_t r = 0; r < n; r++) {
+    for (size_t r = r0; r < n; r++) {
       
       Triangle ti;
       Vector3d cent;
@@ -6,6 +6,89 @@
 #include <sstream>
 #include <fstream>
 #include <iomanip> // set precision on output
+#include <algorithm>
+
+
+void Fluid::setBubbles(const std::vector<TriangleMesh *> &bubs,
+                       const std::vector<size_t> &bubbleIndices,
+                       double timeStamp,
+                       const std::vector<std::string> &fastBEMfilenames,
+                       const std::vector<std::string> &velocityFilenames) {
+  
+  if (bubs.empty()) return;
+  
+  for (size_t i = 0; i < bubs.size(); i++) {
+    if (bubbleIndices[i] >= _bubbles.size()) {
+      _bubbles.resize(bubbleIndices[i] + 1);
+    }
+    _bubbles[bubbleIndices[i]].setBubbleMesh(bubs[i]);
+  }
+  
+  e.setBubbles(bubs, bubbleIndices);
+  
+  std::vector<double> bubCaps;
+  MatrixXd velAirs;
+  e.bubbleCapacitances(bubCaps, velAirs);
+  
+  for (size_t i = 0; i < bubs.size(); i++) {
+    if (isnan(bubCaps[i])) {
+      std::cout << "capacitance is NaN" << std::endl;
+      continue;
+    }
+    
+    VectorXd velAir = velAirs.col(i);
+    
+    float freq_hz = _bubbles[bubbleIndices[i]].setFrequency(timeStamp, bubCaps[i]);
+    _combined.writeFastBEM(fastBEMfilenames[i], velAir, freq_hz);
+    
+    saveAirVelocityFile(velocityFilenames[i], velAir);
+  }
+}
+
+
+void Fluid::mixdownBank(SoundTrack &st, size_t numSamples, size_t retuneInterval) {
+  
+  OscillatorBank bank(PhysicalConstants::Sound::SAMPLING_RATE);
+  bank.reserve(_bubbles.size());
+  
+  // each bubble's oscillator starts from (0, -1) like in integrateVibrationODE,
+  // and is tuned before every block it sounds in
+  std::vector<size_t> ids(_bubbles.size(), OSCBANK_NOT_ACTIVE);
+  TimelineIndex<size_t> timeline;
+  
+  for (size_t b = 0; b < _bubbles.size(); b++) {
+    size_t first, count;
+    if (!_bubbles[b].vibrationRange(first, count)) continue;
+    
+    ids[b] = bank.addOscillator(first, count, 0, 0, 0);
+    timeline.add(b, first, first + count - 1);
+  }
+  timeline.build();
+  
+  std::vector<double> block(retuneInterval);
+  std::vector<size_t> sounding;
+  
+  for (size_t s = 0; s < numSamples; s += retuneInterval) {
+    
+    size_t n = std::min(retuneInterval, numSamples - s);
+    
+    // (the order of the retunes does not matter, so no need to sort)
+    sounding.clear();
+    timeline.query(s, s + n - 1, sounding);
+    for (size_t i = 0; i < sounding.size(); i++) {
+      double omega, beta, scale;
+      _bubbles[sounding[i]].vibrationAt(s + 0.5 * n, omega, beta, scale);
+      bank.retune(ids[sounding[i]], omega, beta, scale);
+    }
+    
+    std::fill(block.begin(), block.begin() + n, 0.0);
+    bank.render(&block[0], n);
+    
+    for (int c = 0; c < st.numChannels(); c++) {
+      st.addSamples(&block[0], n, c);
+    }
+  }
+}
 
 
 //velocityFilename
@@ -25,3 +108,44 @@ void Fluid::saveAirVelocityFile(const std::string &fullFilename, const VectorXd
   
   ofile.close();
 }
+
+
+void Fluid::mixBlock(double *out, size_t firstSample, size_t n) {
+  
+  if (n == 0) return;
+  
+  if (!_mixIndexValid) {
+    _mixIndex.clear();
+    for (size_t b = 0; b < _bubbles.size(); b++) {
+      if (_bubbles[b].hasSamples()) {
+        _mixIndex.add(b, _bubbles[b].firstSample(), _bubbles[b].lastSample());
+      }
+    }
+    _mixIndex.build();
+    _mixIndexValid = true;
+  }
+  
+  _mixIndex.querySorted(firstSample, firstSample + n - 1, _sounding);
+  
+  for (size_t i = 0; i < _sounding.size(); i++) {
+    _bubbles[_sounding[i]].addSamples(out, firstSample, n);
+  }
+}
+
+
+void Fluid::mixdown(SoundTrack &st, size_t numSamples, size_t blockSize) {
+  
+  std::vector<double> block(blockSize);
+  
+  for (size_t s = 0; s < numSamples; s += blockSize) {
+    
+    size_t n = std::min(blockSize, numSamples - s);
+    std::fill(block.begin(), block.begin() + n, 0.0);
+    
+    mixBlock(&block[0], s, n);
+    
+    for (int c = 0; c < st.numChannels(); c++) {
+      st.addSamples(&block[0], n, c);
+    }
+  }
+}
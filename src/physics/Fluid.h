@@ -14,13 +14,17 @@
 #include "Electrostatics.h"
 #include <geometry/TriangleMesh.h>
 #include "Bubble.h"
+#include <numeric/ParallelFor.h>
+#include <numeric/TimelineIndex.h>
+#include <sound/SoundTrack.h>
+#include <sound/OscillatorBank.h>
 
 #include <boost/math/special_functions/fpclassify.hpp>
 
 class Fluid {
 
 public:
-  Fluid() {}
+  Fluid() : _mixIndexValid(false) {}
   
   void setFluidDomain(TriangleMesh *air, TriangleMesh *solid) {
     _air = air;
@@ -46,7 +50,7 @@ public:
     _bubbles[bubbleIndex].setBubbleMesh(bub);
     
     _bubble = bub;
-    e.setBubble(_bubble);
+    e.setBubble(_bubble, bubbleIndex);
     
     VectorXd velAir;
     double bubCap = e.bubbleCapacitance(velAir);
@@ -61,6 +65,20 @@ public:
     }
   }
   
+  // Same as setBubble, but for all the bubbles of one frame at once. They are
+  // solved as a single coupled system (see Electrostatics::setBubbles), which
+  // is dense over all their elements unless the coupling distance is finite.
+  void setBubbles(const std::vector<TriangleMesh *> &bubs,
+                  const std::vector<size_t> &bubbleIndices,
+                  double timeStamp,
+                  const std::vector<std::string> &fastBEMfilenames,
+                  const std::vector<std::string> &velocityFilenames);
+  
+  // Bubbles farther apart than d are not coupled directly in setBubbles
+  void setBubbleCouplingDistance(double d) {
+    e.setBubbleCouplingDistance(d);
+  }
+  
   void printAllFrequencies() const {
     std::cout << "Printing frequencies for " << _bubbles.size() << " bubbles." << std::endl;
     for (size_t b = 0; b < _bubbles.size(); b++) {
@@ -69,13 +87,28 @@ public:
     }
   }
   
-  void integrateAllBubbleSounds() {
-    for (size_t b = 0; b < _bubbles.size(); b++) {
-      std::cout << "Integrating ODE for bubble # " << b << std::endl;
-      _bubbles[b].integrateVibrationODE();
-    }
+  // Each bubble only touches its own state, so the bubbles are split over
+  // nthreads threads (0 = one per core); the result does not depend on it.
+  void integrateAllBubbleSounds(size_t nthreads = 0) {
+    std::cout << "Integrating ODEs for " << _bubbles.size() << " bubbles" << std::endl;
+    parallelFor(_bubbles.size(), IntegrateBubbles(_bubbles), nthreads);
+    _mixIndexValid = false;
   }
   
+  // Adds the sum of all bubbles for samples firstSample .. firstSample + n - 1
+  // to out[0 .. n-1]. Only the bubbles that sound during the block are visited.
+  void mixBlock(double *out, size_t firstSample, size_t n);
+  
+  // Appends samples 0 .. numSamples - 1 of the bubble mix to every channel
+  // of st, rendering blockSize samples at a time
+  void mixdown(SoundTrack &st, size_t numSamples, size_t blockSize = 4096);
+  
+  // Same result as integrateAllBubbleSounds followed by mixdown, but all the
+  // bubbles are stepped together in an OscillatorBank, straight into the
+  // output. Frequency, damping and pressure scale are held for
+  // retuneInterval samples at a time, at their values in the middle.
+  void mixdownBank(SoundTrack &st, size_t numSamples, size_t retuneInterval = 16);
+  
   double getSample(size_t bubbleNum, size_t audioFrame) {
     return _bubbles[bubbleNum].getSample(audioFrame);
   }
@@ -87,10 +120,27 @@ public:
   void saveAirVelocityFile(const std::string &fullFilename, const VectorXd &velAir);
   
 private:
+  
+  struct IntegrateBubbles {
+    IntegrateBubbles(std::vector<Bubble> &bubbles) : _bubbles(bubbles) {}
+    void operator()(size_t begin, size_t end) const {
+      for (size_t b = begin; b < end; b++) {
+        _bubbles[b].integrateVibrationODE();
+      }
+    }
+    std::vector<Bubble> &_bubbles;
+  };
+  
   Electrostatics e;
   
   std::vector<Bubble> _bubbles;
   
+  // The bubbles' sample ranges, for mixBlock. Rebuilt after the sounds
+  // are integrated.
+  TimelineIndex<size_t> _mixIndex;
+  bool _mixIndexValid;
+  std::vector<size_t> _sounding;
+  
   TriangleMesh *_air;
   TriangleMesh *_solid;
   TriangleMesh *_bubble;
@@ -13,6 +13,8 @@
 #include "Monopole.h"
 #include <physics/PhysicalConstants.h>
 
+#include <vector>
+
 
 class Bubble {
   
@@ -82,6 +84,46 @@ public:
     return attack * attenuation * m_mpole.pressure(t_age, ear);
   }
   
+  // Adds pressure(t0 + i dt, ears[e]) to out[e][i] for i = 0 .. n-1, taking
+  // one timestep(dt) per sample that the bubble is alive for, like calling
+  // timestep and pressure at every sample does. The frequency is updated
+  // once per block rather than once per sample.
+  void renderBlock(double t0, double dt, size_t n,
+                   const std::vector<Vector3d> &ears, double * const *out) {
+    
+    size_t first = 0;
+    while (first < n && t0 + first * dt < m_birthtime) first++;
+    
+    size_t end = first;
+    while (end < n && t0 + end * dt <= m_birthtime + S_BUBBLELIFE) end++;
+    
+    if (first == end) return;
+    
+    timestep(dt);
+    m_freq = frequency();
+    m_mpole.frequency(m_freq);
+    
+    m_mpole.renderBlock(t0 + first * dt - m_birthtime, dt, end - first, ears, out, first);
+    
+    for (size_t i = first + 1; i < end; i++) {
+      timestep(dt);
+    }
+  }
+  
+  
+  // Complex amplitude of the pressure at ear at the bubble's current
+  // frequency (see Monopole::transfer)
+  complex<double> transfer(const Vector3d &ear) {
+    m_freq = frequency();
+    m_mpole.frequency(m_freq);
+    return m_mpole.transfer(ear);
+  }
+  
+  // True once the bubble has reached the surface
+  bool finished() const {
+    return m_isFinished;
+  }
+  
   
   double volume_sphere() {
     return 4.0 * M_PI * pow(m_radius, 3) / 3.0;
@@ -0,0 +1,199 @@
+//
+//  Convolver.h
+//  aletler
+//
+//  Convolution with long impulse responses (rooms, HRTFs), by uniformly
+//  partitioned overlap-save. The IR is cut into partitions of B samples and
+//  each partition is transformed once, with an FFT of size 2B. Every block of
+//  B input samples is then transformed, kept in a frequency-domain delay
+//  line, and the output block is the inverse transform of
+//
+//      Y = sum_p  X[now - p] * H_p
+//
+//  so a block costs two FFTs plus one complex multiply-add per partition,
+//  instead of B * (IR length) multiply-adds in the time domain. Output
+//  block k only depends on input blocks up to k, so in block mode there is
+//  no latency beyond the block itself.
+//
+//  One convolver has one input and any number of outputs (one IR each),
+//  sharing the transform of the input: e.g. a mono source rendered to the
+//  two ears of a Listener with a left and a right IR.
+//
+
+#ifndef aletler_Convolver_h
+#define aletler_Convolver_h
+
+#include <vector>
+#include <complex>
+#include <algorithm>
+
+#include <Eigen/Core>
+#include <unsupported/Eigen/FFT>
+
+#include "SoundTrack.h"
+
+
+class PartitionedConvolver {
+
+public:
+
+  typedef std::complex<double> Complex;
+
+  // irs[o] is the impulse response from the input to output o
+  PartitionedConvolver(const std::vector<std::vector<double> > &irs, size_t blockSize = 512)
+  : _blockSize(blockSize), _fftSize(2 * blockSize), _bins(blockSize + 1), _current(0) {
+
+    _fft.SetFlag(Eigen::FFT<double>::HalfSpectrum);
+    _fft.SetFlag(Eigen::FFT<double>::Unscaled);
+
+    size_t longest = 0;
+    for (size_t o = 0; o < irs.size(); o++) {
+      longest = std::max(longest, irs[o].size());
+    }
+    _numPartitions = std::max(size_t(1), (longest + _blockSize - 1) / _blockSize);
+    _numOutputs = irs.size();
+
+    _irSpectra.resize(_numOutputs * _numPartitions * _bins);
+    _inputSpectra.assign(_numPartitions * _bins, Complex(0, 0));
+    _accumulator.resize(_bins);
+    _timeBuffer.assign(_fftSize, 0.0);
+    _outputBuffer.resize(_fftSize);
+
+    // Each partition is zero-padded to 2B. The inverse FFT is unscaled,
+    // so its 1/2B goes in here.
+    std::vector<double> padded(_fftSize);
+    for (size_t o = 0; o < _numOutputs; o++) {
+      for (size_t p = 0; p < _numPartitions; p++) {
+
+        std::fill(padded.begin(), padded.end(), 0.0);
+        size_t begin = std::min(p * _blockSize, irs[o].size());
+        size_t end = std::min(begin + _blockSize, irs[o].size());
+        for (size_t i = begin; i < end; i++) {
+          padded[i - begin] = irs[o][i] / double(_fftSize);
+        }
+
+        _fft.fwd(irSpectrum(o, p), &padded[0], _fftSize);
+      }
+    }
+
+    // let the FFT set up its plans now rather than in the first block
+    _fft.inv(&_outputBuffer[0], &_accumulator[0], _fftSize);
+  }
+
+  size_t blockSize() const { return _blockSize; }
+  size_t numOutputs() const { return _numOutputs; }
+
+  // Length (in samples) of the longest IR that fits in the partitions
+  size_t irCapacity() const { return _numPartitions * _blockSize; }
+
+  // Real-time mode: consumes exactly blockSize() input samples and writes
+  // blockSize() samples to each outputs[o]. Does not allocate.
+  void processBlock(const double *in, double * const *outputs) {
+
+    // slide the input window: [previous block, this block]
+    std::copy(_timeBuffer.begin() + _blockSize, _timeBuffer.end(), _timeBuffer.begin());
+    std::copy(in, in + _blockSize, _timeBuffer.begin() + _blockSize);
+
+    // newest input spectrum goes in the slot of the oldest one
+    _current = (_current + _numPartitions - 1) % _numPartitions;
+    _fft.fwd(inputSpectrum(_current), &_timeBuffer[0], _fftSize);
+
+    for (size_t o = 0; o < _numOutputs; o++) {
+
+      ComplexArrayMap acc(&_accumulator[0], _bins);
+      acc.setZero();
+
+      for (size_t p = 0; p < _numPartitions; p++) {
+        size_t slot = (_current + p) % _numPartitions;
+        acc += ConstComplexArrayMap(inputSpectrum(slot), _bins)
+             * ConstComplexArrayMap(irSpectrum(o, p), _bins);
+      }
+
+      _fft.inv(&_outputBuffer[0], &_accumulator[0], _fftSize);
+
+      // overlap-save: the first half is wrapped around, keep the second
+      std::copy(_outputBuffer.begin() + _blockSize, _outputBuffer.end(), outputs[o]);
+    }
+  }
+
+  // Forgets all past input
+  void reset() {
+    std::fill(_inputSpectra.begin(), _inputSpectra.end(), Complex(0, 0));
+    std::fill(_timeBuffer.begin(), _timeBuffer.end(), 0.0);
+    _current = 0;
+  }
+
+  // Offline: convolves all n samples of in, appending the full result
+  // (n + irCapacity() - 1 samples, the tail included) to channels
+  // firstChannel .. firstChannel + numOutputs() - 1 of out
+  void convolve(const double *in, size_t n, SoundTrack &out, int firstChannel = 0) {
+
+    reset();
+
+    size_t total = n + irCapacity() - 1;
+    std::vector<double> block(_blockSize);
+    std::vector<std::vector<double> > results(_numOutputs, std::vector<double>(_blockSize));
+    std::vector<double *> outputs(_numOutputs);
+    for (size_t o = 0; o < _numOutputs; o++) {
+      outputs[o] = &results[o][0];
+    }
+
+    for (size_t s = 0; s < total; s += _blockSize) {
+
+      std::fill(block.begin(), block.end(), 0.0);
+      if (s < n) {
+        std::copy(in + s, in + std::min(n, s + _blockSize), block.begin());
+      }
+
+      processBlock(&block[0], &outputs[0]);
+
+      size_t len = std::min(_blockSize, total - s);
+      for (size_t o = 0; o < _numOutputs; o++) {
+        out.addSamples(outputs[o], len, firstChannel + int(o));
+      }
+    }
+  }
+
+private:
+
+  typedef Eigen::Map<Eigen::ArrayXcd> ComplexArrayMap;
+  typedef Eigen::Map<const Eigen::ArrayXcd> ConstComplexArrayMap;
+
+  size_t _blockSize, _fftSize, _bins;
+  size_t _numPartitions, _numOutputs;
+
+  Eigen::FFT<double> _fft;
+
+  // H_p for every output, [output][partition][bin]
+  std::vector<Complex> _irSpectra;
+
+  // frequency-domain delay line: the spectra of the last _numPartitions
+  // input windows, newest at _current, older ones after it (circularly)
+  std::vector<Complex> _inputSpectra;
+  size_t _current;
+
+  std::vector<Complex> _accumulator;
+  std::vector<double> _timeBuffer, _outputBuffer;
+
+  Complex *irSpectrum(size_t o, size_t p) {
+    return &_irSpectra[(o * _numPartitions + p) * _bins];
+  }
+
+  Complex *inputSpectrum(size_t slot) {
+    return &_inputSpectra[slot * _bins];
+  }
+};
+
+
+// Renders a mono signal to every location of a Listener (e.g. leftEar and
+// rightEar) through one IR per location, appending channel i of out for
+// location i
+inline void convolveToListener(const double *in, size_t n,
+                               const std::vector<std::vector<double> > &earIRs,
+                               SoundTrack &out, size_t blockSize = 512) {
+  PartitionedConvolver conv(earIRs, blockSize);
+  conv.convolve(in, n, out);
+}
+
+
+#endif
@@ -0,0 +1,277 @@
+//
+//  DopplerRenderer.h
+//  aletler
+//
+//  Renders moving sources to moving listeners with their propagation
+//  delay. What a listener at x hears at time t is what the source emitted
+//  at the retarded time t - tau, where
+//
+//      tau = |x(t) - y(t - tau)| / c
+//
+//  and a tau that changes over time is the Doppler shift. Each source
+//  writes what it emits into its own circular delay line, and each
+//  source-listener pair reads it back at its delay, which is solved for at
+//  the block boundaries and interpolated linearly in between. The read
+//  positions fall between samples, so the delay lines are read through a
+//  cubic Lagrange interpolator in Farrow form (one polynomial in the
+//  fractional delay, four taps).
+//
+//  The level falls off as 1 / (4 pi r) with the distance r = c tau
+//  travelled, like Monopole's Green's function; the Mach-number
+//  correction to the amplitude is left out (bubbles rise at well under
+//  1 m/s).
+//
+
+#ifndef aletler_DopplerRenderer_h
+#define aletler_DopplerRenderer_h
+
+#include <vector>
+#include <deque>
+#include <cmath>
+#include <algorithm>
+#include <cassert>
+
+#include <Eigen/Dense>
+
+#include <physics/PhysicalConstants.h>
+
+
+// Shortest delay (in samples) a pair can have: the interpolator reads two
+// samples past its position, which must have been written already
+static const double DOPPLER_MIN_DELAY = 2;
+
+
+class DopplerRenderer {
+
+public:
+
+  // maxDelay (in seconds) bounds how far sources and listeners can be
+  // apart, c * maxDelay, and maxBlock the number of samples per process
+  DopplerRenderer(double sampleRate = PhysicalConstants::Sound::SAMPLING_RATE,
+                  double maxDelay = 0.5, size_t maxBlock = 4096,
+                  double c = PhysicalConstants::Sound::C_AIR)
+  : _sampleRate(sampleRate), _c(c), _maxBlock(maxBlock), _now(0) {
+
+    _maxDelay = std::max(maxDelay * sampleRate, DOPPLER_MIN_DELAY);
+
+    // history kept in the delay lines, rounded up to a power of two
+    size_t needed = size_t(ceil(_maxDelay)) + maxBlock + 4;
+    _lineLength = 1;
+    while (_lineLength < needed) _lineLength *= 2;
+    _mask = _lineLength - 1;
+  }
+
+  // Adds a source at pos, silent up to now. Returns its index.
+  size_t addSource(const Eigen::Vector3d &pos) {
+
+    Source s;
+    s.line.assign(_lineLength, 0.0);
+    s.next = pos;
+    s.path.push_back(Waypoint(double(_now), pos));
+    _sources.push_back(s);
+
+    for (size_t l = 0; l < _listeners.size(); l++) {
+      _delays[l].push_back(retardedDelay(_sources.back(), _listeners[l].position, double(_now), 0));
+    }
+    return _sources.size() - 1;
+  }
+
+  // Adds a listener at pos. Returns its index.
+  size_t addListener(const Eigen::Vector3d &pos) {
+
+    Listener l;
+    l.position = l.next = pos;
+    _listeners.push_back(l);
+
+    _delays.push_back(std::vector<double>(_sources.size()));
+    for (size_t s = 0; s < _sources.size(); s++) {
+      _delays.back()[s] = retardedDelay(_sources[s], pos, double(_now), 0);
+    }
+    return _listeners.size() - 1;
+  }
+
+  // Where a source / listener will be at the end of the next block; in
+  // between it moves in a straight line
+  void moveSource(size_t s, const Eigen::Vector3d &pos) { _sources[s].next = pos; }
+  void moveListener(size_t l, const Eigen::Vector3d &pos) { _listeners[l].next = pos; }
+
+  size_t numSources() const { return _sources.size(); }
+  size_t numListeners() const { return _listeners.size(); }
+
+  // Index of the next sample that process will produce
+  size_t position() const { return _now; }
+
+  // Current delay (in samples) from source s to listener l
+  double delay(size_t s, size_t l) const { return _delays[l][s]; }
+
+  // Consumes n <= maxBlock samples emitted by each source (emitted[s]) and
+  // adds the n samples each listener hears to out[l]
+  void process(const double * const *emitted, double * const *out, size_t n) {
+
+    assert(n <= _maxBlock);
+    if (n == 0) return;
+
+    double end = double(_now + n);
+
+    for (size_t s = 0; s < _sources.size(); s++) {
+      Source &src = _sources[s];
+      for (size_t i = 0; i < n; i++) {
+        src.line[(_now + i) & _mask] = emitted[s][i];
+      }
+
+      src.path.push_back(Waypoint(end, src.next));
+
+      // forget the part of the path that nothing can hear any more
+      while (src.path.size() > 2 && src.path[1].time < double(_now) - _maxDelay) {
+        src.path.pop_front();
+      }
+    }
+
+    for (size_t l = 0; l < _listeners.size(); l++) {
+
+      const Eigen::Vector3d &to = _listeners[l].next;
+
+      for (size_t s = 0; s < _sources.size(); s++) {
+
+        double d0 = _delays[l][s];
+        double d1 = retardedDelay(_sources[s], to, end, d0);
+        _delays[l][s] = d1;
+
+        renderPair(_sources[s].line, d0, d1, out[l], n);
+      }
+
+      _listeners[l].position = to;
+    }
+
+    _now += n;
+  }
+
+  // Silences the delay lines and clears the paths, keeping everyone where
+  // they are, and restarts at sample 0
+  void reset() {
+    _now = 0;
+    for (size_t s = 0; s < _sources.size(); s++) {
+      Source &src = _sources[s];
+      std::fill(src.line.begin(), src.line.end(), 0.0);
+      src.path.clear();
+      src.path.push_back(Waypoint(0, src.next));
+    }
+    for (size_t l = 0; l < _listeners.size(); l++) {
+      _listeners[l].position = _listeners[l].next;
+      for (size_t s = 0; s < _sources.size(); s++) {
+        _delays[l][s] = retardedDelay(_sources[s], _listeners[l].position, 0, 0);
+      }
+    }
+  }
+
+  // Cubic Lagrange interpolation between x[0] and x[1] at fraction mu, from
+  // the taps x[-1] .. x[2], in Farrow form
+  static double farrow(double xm1, double x0, double x1, double x2, double mu) {
+    double c1 = x1 - xm1 / 3 - x0 / 2 - x2 / 6;
+    double c2 = (xm1 + x1) / 2 - x0;
+    double c3 = (x2 - xm1) / 6 + (x0 - x1) / 2;
+    return ((c3 * mu + c2) * mu + c1) * mu + x0;
+  }
+
+private:
+
+  struct Waypoint {
+    Waypoint(double t, const Eigen::Vector3d &p) : time(t), position(p) {}
+    double time;
+    Eigen::Vector3d position;
+  };
+
+  struct Source {
+    std::vector<double> line;
+    std::deque<Waypoint> path;
+    Eigen::Vector3d next;
+  };
+
+  struct Listener {
+    Eigen::Vector3d position, next;
+  };
+
+  double _sampleRate, _c;
+  double _maxDelay;
+  size_t _maxBlock;
+  size_t _lineLength, _mask;
+  size_t _now;
+
+  std::vector<Source> _sources;
+  std::vector<Listener> _listeners;
+
+  // _delays[l][s]: delay in samples from source s to listener l at _now
+  std::vector<std::vector<double> > _delays;
+
+  // Position of a source at time t (in samples) along its path
+  Eigen::Vector3d sourceAt(const Source &src, double t) const {
+    const std::deque<Waypoint> &path = src.path;
+    if (t <= path.front().time) return path.front().position;
+    if (t >= path.back().time) return path.back().position;
+
+    size_t i = path.size() - 1;
+    while (path[i - 1].time > t) i--;
+    const Waypoint &a = path[i - 1], &b = path[i];
+    double u = (t - a.time) / (b.time - a.time);
+    return a.position + u * (b.position - a.position);
+  }
+
+  // Delay (in samples) of what a listener at x hears at time t: the
+  // fixed point of tau = |x - y(t - tau)| / c, which the iteration reaches
+  // quickly since the sources move much slower than sound
+  double retardedDelay(const Source &src, const Eigen::Vector3d &x, double t, double guess) const {
+    double perSample = _sampleRate / _c;
+    double tau = guess;
+    for (int iter = 0; iter < 20; iter++) {
+      double next = (x - sourceAt(src, t - tau)).norm() * perSample;
+      bool done = fabs(next - tau) < 1e-6;
+      tau = next;
+      if (done) break;
+    }
+    return std::min(std::max(tau, DOPPLER_MIN_DELAY), _maxDelay);
+  }
+
+  // Adds n samples of one delay line, read at delays going linearly from
+  // d0 to d1 and scaled by 1 / (4 pi r), to out
+  void renderPair(const std::vector<double> &line, double d0, double d1, double *out, size_t n) {
+
+    double metresPerSample = _c / _sampleRate;
+    double g0 = 0.25 * M_1_PI / std::max(d0 * metresPerSample, 1e-3);
+    double g1 = 0.25 * M_1_PI / std::max(d1 * metresPerSample, 1e-3);
+    double dd = (d1 - d0) / double(n);
+    double dg = (g1 - g0) / double(n);
+
+    // Copy the stretch of the line that the block reads, unwrapped, so the
+    // loop below has no masking and its read positions are positive.
+    // Before sample 0 the indices wrap around to the (silent) end of the line.
+    double first = double(_now) - d0;
+    double last = double(_now + n - 1) - (d0 + dd * double(n - 1));
+    long long lo = (long long)floor(std::min(first, last)) - 1;
+    long long hi = (long long)floor(std::max(first, last)) + 2;
+
+    size_t len = size_t(hi - lo + 1);
+    _window.resize(len);
+    for (size_t k = 0; k < len; k++) {
+      _window[k] = line[size_t(lo + (long long)k) & _mask];
+    }
+
+    const double *x = &_window[0];
+    double start = first - double(lo);
+    double stride = 1 - dd;
+
+    for (size_t i = 0; i < n; i++) {
+      double pos = start + stride * double(i);
+      long k = long(pos);
+      double mu = pos - double(k);
+
+      double y = farrow(x[k - 1], x[k], x[k + 1], x[k + 2], mu);
+      out[i] += (g0 + dg * double(i)) * y;
+    }
+  }
+
+  // scratch for renderPair
+  std::vector<double> _window;
+};
+
+
+#endif
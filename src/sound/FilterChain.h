@@ -0,0 +1,208 @@
+//
+//  FilterChain.h
+//  aletler
+//
+//  Filters as small stateful objects that are composed at compile time.
+//  A stage has
+//
+//    void process(double *x, size_t n);   // filters x in place
+//    void reset();                        // forgets its history
+//
+//  and keeps whatever history it needs between calls, so a long signal can
+//  be fed to it one block at a time. Chain<A, B> runs A then B on each block;
+//  since blocks are small enough to stay in the L1 cache, a chain of stages
+//  costs one pass over memory instead of one per stage.
+//
+//  applyFilter runs a stage over every channel of a SoundTrack, one copy of
+//  the stage per channel, with the channels split over threads.
+//
+
+#ifndef aletler_FilterChain_h
+#define aletler_FilterChain_h
+
+#include <vector>
+#include <cmath>
+
+#include <numeric/ParallelFor.h>
+#include "SoundTrack.h"
+
+// Samples per block (16 KB of doubles)
+#define FILTER_BLOCK 2048
+
+
+// y = g x  (the old scale_filter)
+struct Gain {
+
+  Gain(double g = 1) : gain(g) {}
+
+  void process(double *x, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+      x[i] *= gain;
+    }
+  }
+
+  void reset() {}
+
+  double gain;
+};
+
+
+// y[i] = x[i] + x[i-1]  (the old filter_simplest_lowpass). The old version
+// dropped the first sample; here x[-1] is taken to be 0 so the length stays
+// the same.
+struct SimplestLowpass {
+
+  SimplestLowpass() : _last(0) {}
+
+  void process(double *x, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+      double xi = x[i];
+      x[i] = xi + _last;
+      _last = xi;
+    }
+  }
+
+  void reset() { _last = 0; }
+
+private:
+  double _last;
+};
+
+
+// Second-order IIR section, transposed direct form II:
+// y = (b0 + b1 z^-1 + b2 z^-2) / (1 + a1 z^-1 + a2 z^-2) x
+struct Biquad {
+
+  Biquad(double b0 = 1, double b1 = 0, double b2 = 0, double a1 = 0, double a2 = 0)
+  : _b0(b0), _b1(b1), _b2(b2), _a1(a1), _a2(a2), _z1(0), _z2(0) {}
+
+  // Butterworth-style lowpass (q = 1/sqrt(2)) from the RBJ cookbook
+  static Biquad lowpass(double cutoff, double samplerate, double q = M_SQRT1_2) {
+    double w0 = 2 * M_PI * cutoff / samplerate;
+    double alpha = sin(w0) / (2 * q);
+    double c = cos(w0);
+    double a0 = 1 + alpha;
+    return Biquad((1 - c) / (2 * a0), (1 - c) / a0, (1 - c) / (2 * a0),
+                  -2 * c / a0, (1 - alpha) / a0);
+  }
+
+  void process(double *x, size_t n) {
+    double z1 = _z1, z2 = _z2;
+    for (size_t i = 0; i < n; i++) {
+      double xi = x[i];
+      double yi = _b0 * xi + z1;
+      z1 = _b1 * xi - _a1 * yi + z2;
+      z2 = _b2 * xi - _a2 * yi;
+      x[i] = yi;
+    }
+    _z1 = z1;
+    _z2 = z2;
+  }
+
+  void reset() { _z1 = _z2 = 0; }
+
+private:
+  double _b0, _b1, _b2, _a1, _a2;
+  double _z1, _z2;
+};
+
+
+// A followed by B
+template <typename A, typename B>
+struct Chain {
+
+  Chain(const A &a, const B &b) : first(a), second(b) {}
+
+  void process(double *x, size_t n) {
+    first.process(x, n);
+    second.process(x, n);
+  }
+
+  void reset() {
+    first.reset();
+    second.reset();
+  }
+
+  A first;
+  B second;
+};
+
+template <typename A, typename B>
+inline Chain<A, B> chain(const A &a, const B &b) {
+  return Chain<A, B>(a, b);
+}
+
+template <typename A, typename B, typename C>
+inline Chain<Chain<A, B>, C> chain(const A &a, const B &b, const C &c) {
+  return chain(chain(a, b), c);
+}
+
+
+// Runs a stage over a long buffer one block at a time
+template <typename Stage>
+inline void processBlocks(Stage &stage, double *x, size_t n) {
+  for (size_t i = 0; i < n; i += FILTER_BLOCK) {
+    stage.process(x + i, std::min(size_t(FILTER_BLOCK), n - i));
+  }
+}
+
+
+// One copy of a stage per channel, for filtering multichannel audio that
+// arrives in blocks (e.g. from SoundFileManager::readBlock)
+template <typename Stage>
+class ChannelFilter {
+
+public:
+
+  ChannelFilter(const Stage &stage, int nchannels) : _stages(nchannels, stage) {}
+
+  // channels[c] holds n samples of channel c. With more than one thread,
+  // each channel is filtered on its own thread.
+  void process(double * const *channels, size_t n, size_t nthreads = 1) {
+    parallelFor(_stages.size(), Run(_stages, channels, n), nthreads);
+  }
+
+  void reset() {
+    for (size_t c = 0; c < _stages.size(); c++) {
+      _stages[c].reset();
+    }
+  }
+
+  int numChannels() const { return int(_stages.size()); }
+
+private:
+
+  struct Run {
+    Run(std::vector<Stage> &stages, double * const *channels, size_t n)
+    : _stages(stages), _channels(channels), _n(n) {}
+    void operator()(size_t begin, size_t end) const {
+      for (size_t c = begin; c < end; c++) {
+        processBlocks(_stages[c], _channels[c], _n);
+      }
+    }
+    std::vector<Stage> &_stages;
+    double * const *_channels;
+    size_t _n;
+  };
+
+  std::vector<Stage> _stages;
+};
+
+
+// Filters every channel of st in place, starting from the stage as given
+// (so pass a freshly reset one). nthreads = 0 means one per core.
+template <typename Stage>
+inline void applyFilter(SoundTrack &st, const Stage &stage, size_t nthreads = 0) {
+
+  ChannelFilter<Stage> filter(stage, st.numChannels());
+
+  std::vector<double *> channels(st.numChannels());
+  for (int c = 0; c < st.numChannels(); c++) {
+    channels[c] = st.channelData(c);
+  }
+
+  filter.process(&channels[0], st.numSamples(), nthreads);
+}
+
+
+#endif
@@ -14,6 +14,8 @@
 #include <physics/PhysicalConstants.h>
 #include <Eigen/Dense>
 #include <complex>
+#include <vector>
+#include <algorithm>
 
 
 using namespace Eigen;
@@ -21,6 +23,10 @@ using namespace std;
 
 using namespace PhysicalConstants;
 
+// Largest change in the phase of the transfer to an ear (in radians) that
+// Monopole::renderBlock interpolates over
+static const double MONOPOLE_MAX_PHASE_STEP = 0.25;
+
 class Monopole {
 public:
   Monopole() {}
@@ -39,17 +45,56 @@ public:
     
     if (m_freq == 0.0) return 0;
     
-    complex<double> g = greens(ear);
-    
-    complex<double> complex_press = -ii * m_k * Sound::C_AIR * Fluids::RHO_AIR * g * exp(-ii * m_omega * t);
+    complex<double> complex_press = transfer(ear) * exp(-ii * m_omega * t);
     
     return complex_press.real();
   }
   
+  // Complex amplitude of the pressure at ear: pressure(t, ear) is the real
+  // part of transfer(ear) e^{-i omega t}
+  complex<double> transfer(const Vector3d &ear) const {
+    return transferFrom(m_source_pos, ear);
+  }
+  
+  // Adds pressure(t0 + i dt, ears[e]) to out[e][offset + i] for i = 0 .. n-1 and
+  // every ear, and moves the source by step(n * dt). The transfer to each
+  // ear is computed at the ends of the block and interpolated in between
+  // (geometrically, so that the 1/r falloff and the e^{ikr} phase move
+  // smoothly), and the carrier e^{-i omega t} is folded into the same
+  // per-sample complex multiply. A block costs two Green's functions per
+  // ear rather than one per sample; a moving source gets one more for
+  // every fraction of a wavelength it travels.
+  void renderBlock(double t0, double dt, size_t n,
+                   const std::vector<Vector3d> &ears, double * const *out,
+                   size_t offset = 0) {
+    
+    if (n == 0) return;
+    
+    if (m_freq == 0.0) {
+      step(n * dt);
+      return;
+    }
+    
+    // keep the phase change of the transfer under MONOPOLE_MAX_PHASE_STEP radians
+    // between interpolation points
+    double travel = m_k * m_source_vel.norm() * n * dt;
+    size_t segments = std::min(n, size_t(ceil(travel / MONOPOLE_MAX_PHASE_STEP)));
+    segments = std::max(segments, size_t(1));
+    
+    for (size_t s = 0; s < segments; s++) {
+      size_t begin = s * n / segments;
+      size_t end = (s + 1) * n / segments;
+      renderSegment(t0 + begin * dt, dt, end - begin, ears, out, offset + begin);
+    }
+  }
+  
   
   // Update position
   void position(Vector3d pos) { m_source_pos = pos; }
   
+  // Update velocity (used by step)
+  void velocity(Vector3d vel) { m_source_vel = vel; }
+  
   void step(double dt) {
     m_source_pos += dt * m_source_vel;
   }
@@ -76,15 +121,62 @@ private:
   // Wavenumber
   double m_k;
   
-  complex<double> greens_expansion(Vector3d ear) const {
+  complex<double> transferFrom(const Vector3d &source, const Vector3d &ear) const {
+    return -ii * m_k * Sound::C_AIR * Fluids::RHO_AIR * SphericalTools::Greens(m_k, ear - source);
+  }
+  
+  // renderBlock for one interpolation interval. Runs once per bubble per
+  // block, so it does not allocate.
+  void renderSegment(double t0, double dt, size_t n,
+                     const std::vector<Vector3d> &ears, double * const *out,
+                     size_t offset) {
+    
+    const Vector3d p0 = m_source_pos;
+    step(n * dt);
+    
+    // the carrier is recomputed exactly once per segment, so rounding in
+    // the recurrence cannot build up
+    const complex<double> start = exp(-ii * m_omega * t0);
+    const complex<double> rotate = exp(-ii * m_omega * dt);
+    
+    for (size_t e = 0; e < ears.size(); e++) {
+      
+      complex<double> h0 = transferFrom(p0, ears[e]);
+      complex<double> h1 = transfer(ears[e]);
+      double r0 = (ears[e] - p0).norm();
+      double r1 = (ears[e] - m_source_pos).norm();
+      
+      // h1 / h0 = e^{growth}; pick the branch of its phase that matches
+      // the change in distance
+      complex<double> growth = log(h1 / h0);
+      double turns = (m_k * (r1 - r0) - growth.imag()) / (2 * M_PI);
+      growth += ii * (2 * M_PI * floor(turns + 0.5));
+      
+      complex<double> z = h0 * start;
+      complex<double> w = exp(growth / double(n)) * rotate;
+      double *o = out[e] + offset;
+      
+      for (size_t i = 0; i < n; i++) {
+        o[i] += z.real();
+        z *= w;
+      }
+    }
+  }
+  
+  // Multipole expansion of the Green's function about the origin, up to
+  // degree N - 1 (valid for |ear| < |source|)
+  complex<double> greens_expansion(Vector3d ear, int N = 4) const {
+    
+    int terms = N * N;
+    std::vector<complex<double> > s(terms), r(terms);
+    SphericalTools::S_all(N - 1, m_k, m_source_pos, &s[0]);
+    SphericalTools::R_all(N - 1, m_k, ear, &r[0]);
     
     complex<double> sphharmsum = 0.0;
     
-    // TODO: magic const
-    for (int n = 0; n < 4; n++) {
+    for (int n = 0; n < N; n++) {
       for (int m = -n; m <= n; m++) {
-        sphharmsum += SphericalTools::S(-m, n, m_k, m_source_pos)
-        * SphericalTools::R(m, n, m_k, ear);
+        sphharmsum += s[SphericalTools::index(-m, n)] * r[SphericalTools::index(m, n)];
       }
     }
     
@@ -0,0 +1,372 @@
+//
+//  Multipole.cpp
+//  aletler
+//
+
+#include "Multipole.h"
+
+#include <limits>
+
+
+void MultipoleTree::buildBoxes(size_t leafSize) {
+
+  // bounding cube of everything
+  Eigen::Vector3d lo = Eigen::Vector3d::Constant(std::numeric_limits<double>::max());
+  Eigen::Vector3d hi = -lo;
+  for (size_t i = 0; i < _sources.size(); i++) {
+    lo = lo.cwiseMin(_sources[i]);
+    hi = hi.cwiseMax(_sources[i]);
+  }
+  for (size_t i = 0; i < _listeners.size(); i++) {
+    lo = lo.cwiseMin(_listeners[i]);
+    hi = hi.cwiseMax(_listeners[i]);
+  }
+  if (_sources.empty() && _listeners.empty()) {
+    lo.setZero();
+    hi.setZero();
+  }
+
+  _size = (hi - lo).maxCoeff();
+  if (_size <= 0) _size = 1;
+  _size *= 1 + 1e-9;
+  _corner = 0.5 * (lo + hi) - Eigen::Vector3d::Constant(0.5 * _size);
+
+  // about leafSize sources per leaf, on average over the whole cube
+  _leafLevel = 0;
+  while (_leafLevel < MAX_DEPTH && double(leafSize) * pow(8.0, _leafLevel + 0.5) < double(_sources.size())) {
+    _leafLevel++;
+  }
+
+  _levels.assign(_leafLevel + 1, std::vector<Box>());
+  _lookup.assign(_leafLevel + 1, std::map<unsigned long long, size_t>());
+
+  int cells = 1 << _leafLevel;
+  double w = _size / cells;
+
+  for (int pass = 0; pass < 2; pass++) {
+    const std::vector<Eigen::Vector3d> &points = pass == 0 ? _sources : _listeners;
+
+    for (size_t i = 0; i < points.size(); i++) {
+      Eigen::Vector3d c = (points[i] - _corner) / w;
+      int ix = std::min(std::max(int(floor(c[0])), 0), cells - 1);
+      int iy = std::min(std::max(int(floor(c[1])), 0), cells - 1);
+      int iz = std::min(std::max(int(floor(c[2])), 0), cells - 1);
+
+      Box &leaf = _levels[_leafLevel][boxAt(_leafLevel, ix, iy, iz)];
+      if (pass == 0) {
+        leaf.sources.push_back(i);
+        leaf.numSources++;
+      } else {
+        leaf.listeners.push_back(i);
+        leaf.numListeners++;
+      }
+    }
+  }
+
+  for (int level = _leafLevel; level > 0; level--) {
+    for (size_t b = 0; b < _levels[level].size(); b++) {
+      const Box &box = _levels[level][b];
+      size_t parent = boxAt(level - 1, box.ix / 2, box.iy / 2, box.iz / 2);
+
+      _levels[level][b].parent = long(parent);
+      Box &p = _levels[level - 1][parent];
+      p.children.push_back(b);
+      p.numSources += _levels[level][b].numSources;
+      p.numListeners += _levels[level][b].numListeners;
+    }
+  }
+}
+
+
+void MultipoleTree::chooseLevels(int pmax, double digits) {
+
+  _p.resize(_leafLevel + 1);
+  for (int level = 0; level <= _leafLevel; level++) {
+    _p[level] = MultipoleTools::truncation(_k, boxRadius(level), digits);
+  }
+
+  // boxes two apart (the first that are well separated) exist from level 2
+  // on; the coarsest of those levels that pmax allows does the far field
+  _topLevel = _leafLevel + 1;
+  for (int level = 2; level <= _leafLevel; level++) {
+    if (_p[level] <= pmax) {
+      _topLevel = level;
+      break;
+    }
+  }
+}
+
+
+static bool adjacent(int ax, int ay, int az, int bx, int by, int bz) {
+  return abs(ax - bx) <= 1 && abs(ay - by) <= 1 && abs(az - bz) <= 1;
+}
+
+
+void MultipoleTree::buildInteractions() {
+
+  std::vector<Box> &leaves = _levels[_leafLevel];
+
+  // without any expansion level, everything is near field
+  if (_topLevel > _leafLevel) {
+    for (size_t b = 0; b < leaves.size(); b++) {
+      if (leaves[b].numListeners == 0) continue;
+      for (size_t s = 0; s < leaves.size(); s++) {
+        if (leaves[s].numSources > 0) leaves[b].nearBoxes.push_back(s);
+      }
+    }
+    return;
+  }
+
+  for (int level = _topLevel; level <= _leafLevel; level++) {
+
+    std::vector<Box> &boxes = _levels[level];
+    int nterms = MultipoleTools::numTerms(_p[level]);
+
+    for (size_t b = 0; b < boxes.size(); b++) {
+
+      if (boxes[b].numSources > 0) {
+        boxes[b].M = MultipoleCoefficients::Zero(nterms);
+        if (level > _topLevel) {
+          const Box &parent = _levels[level - 1][boxes[b].parent];
+          boxes[b].toParent = translation(MULTIPOLE_TO_MULTIPOLE, level, level - 1, boxes[b], parent);
+        }
+      }
+
+      if (boxes[b].numListeners == 0) continue;
+
+      boxes[b].L = MultipoleCoefficients::Zero(nterms);
+
+      if (level == _topLevel) {
+        for (size_t s = 0; s < boxes.size(); s++) {
+          if (boxes[s].numSources > 0
+              && !adjacent(boxes[s].ix, boxes[s].iy, boxes[s].iz, boxes[b].ix, boxes[b].iy, boxes[b].iz)) {
+            boxes[b].farBoxes.push_back(s);
+          }
+        }
+      } else {
+        const Box &parent = _levels[level - 1][boxes[b].parent];
+        boxes[b].fromParent = translation(LOCAL_TO_LOCAL, level - 1, level, parent, boxes[b]);
+
+        // children of the parent's neighbours that are not our neighbours
+        for (int dx = -1; dx <= 1; dx++) {
+          for (int dy = -1; dy <= 1; dy++) {
+            for (int dz = -1; dz <= 1; dz++) {
+              long pn = findBox(level - 1, parent.ix + dx, parent.iy + dy, parent.iz + dz);
+              if (pn < 0) continue;
+              const std::vector<size_t> &children = _levels[level - 1][pn].children;
+              for (size_t c = 0; c < children.size(); c++) {
+                const Box &s = boxes[children[c]];
+                if (s.numSources > 0 && !adjacent(s.ix, s.iy, s.iz, boxes[b].ix, boxes[b].iy, boxes[b].iz)) {
+                  boxes[b].farBoxes.push_back(children[c]);
+                }
+              }
+            }
+          }
+        }
+      }
+
+      for (size_t f = 0; f < boxes[b].farBoxes.size(); f++) {
+        boxes[b].farTranslations.push_back(translation(MULTIPOLE_TO_LOCAL, level, level,
+                                                       boxes[boxes[b].farBoxes[f]], boxes[b]));
+      }
+    }
+  }
+
+  for (size_t b = 0; b < leaves.size(); b++) {
+    if (leaves[b].numListeners == 0) continue;
+    for (int dx = -1; dx <= 1; dx++) {
+      for (int dy = -1; dy <= 1; dy++) {
+        for (int dz = -1; dz <= 1; dz++) {
+          long n = findBox(_leafLevel, leaves[b].ix + dx, leaves[b].iy + dy, leaves[b].iz + dz);
+          if (n >= 0 && leaves[n].numSources > 0) {
+            leaves[b].nearBoxes.push_back(size_t(n));
+          }
+        }
+      }
+    }
+  }
+}
+
+
+// Translations only depend on the kind, the level and the offset between
+// the boxes, so they are shared by every pair of boxes with the same one.
+// Their rotations only depend on the polar angle of the offset and their
+// coaxial parts on its length, so those are shared further.
+const MultipoleTranslation *MultipoleTree::translation(MultipoleTranslationKind kind,
+                                                       int levelIn, int levelOut,
+                                                       const Box &in, const Box &out) {
+
+  // offset from in to out, in units of half the finer box width
+  int dx, dy, dz;
+  double radius;
+
+  if (kind == MULTIPOLE_TO_MULTIPOLE) {
+    dx = 4 * out.ix + 1 - 2 * in.ix;
+    dy = 4 * out.iy + 1 - 2 * in.iy;
+    dz = 4 * out.iz + 1 - 2 * in.iz;
+    radius = 2 * boxRadius(levelOut);
+  } else if (kind == LOCAL_TO_LOCAL) {
+    dx = 2 * out.ix - 4 * in.ix - 1;
+    dy = 2 * out.iy - 4 * in.iy - 1;
+    dz = 2 * out.iz - 4 * in.iz - 1;
+    radius = boxRadius(levelOut);
+  } else {
+    dx = 2 * (out.ix - in.ix);
+    dy = 2 * (out.iy - in.iy);
+    dz = 2 * (out.iz - in.iz);
+    radius = boxRadius(levelOut);
+  }
+
+  const long long bias = 1 << 13;
+  unsigned long long dd = (unsigned long long)(dx * (long long)dx + dy * (long long)dy + dz * (long long)dz);
+
+  unsigned long long key = (unsigned long long)kind
+                         | ((unsigned long long)levelOut << 4)
+                         | ((unsigned long long)(dx + bias) << 8)
+                         | ((unsigned long long)(dy + bias) << 23)
+                         | ((unsigned long long)(dz + bias) << 38);
+
+  std::map<unsigned long long, MultipoleTranslation>::iterator it = _translations.find(key);
+  if (it != _translations.end()) {
+    return &it->second;
+  }
+
+  Eigen::Vector3d shift = out.center - in.center;
+  double theta, phi;
+  MultipoleTranslation::direction(shift, theta, phi);
+
+  unsigned long long rotationKey = (unsigned long long)(dz + bias) | (dd << 16);
+  std::shared_ptr<const SphericalRotation> &rotation = _rotations[rotationKey];
+  if (!rotation) {
+    rotation.reset(new SphericalRotation(_p[std::min(levelIn, levelOut)], theta));
+  }
+
+  unsigned long long coaxialKey = (unsigned long long)kind
+                                | ((unsigned long long)levelOut << 4)
+                                | (dd << 8);
+  std::shared_ptr<const CoaxialTranslation> &coaxial = _coaxials[coaxialKey];
+  if (!coaxial) {
+    coaxial.reset(new CoaxialTranslation(kind, _k, _p[levelIn], _p[levelOut], shift.norm(), radius));
+  }
+
+  it = _translations.insert(std::make_pair(key, MultipoleTranslation(rotation, coaxial, phi))).first;
+  return &it->second;
+}
+
+
+// Multipole expansions of the leaves from their sources, then of each
+// coarser level from its children
+struct MultipoleTree::UpwardPass {
+  UpwardPass(std::vector<Box> &boxes, const std::vector<Box> *children,
+             const std::vector<Eigen::Vector3d> &sources,
+             const std::vector<std::complex<double> > &strengths, double k, int p)
+  : _boxes(boxes), _children(children), _sources(sources), _strengths(strengths), _k(k), _p(p) {}
+
+  void operator()(size_t begin, size_t end) const {
+    for (size_t b = begin; b < end; b++) {
+      Box &box = _boxes[b];
+      if (box.numSources == 0) continue;
+
+      box.M.setZero();
+      if (_children == NULL) {
+        for (size_t i = 0; i < box.sources.size(); i++) {
+          size_t s = box.sources[i];
+          MultipoleTools::addSourceToMultipole(_k, _p, _sources[s] - box.center, _strengths[s], box.M);
+        }
+      } else {
+        for (size_t c = 0; c < box.children.size(); c++) {
+          const Box &child = (*_children)[box.children[c]];
+          if (child.numSources > 0) child.toParent->apply(child.M, box.M);
+        }
+      }
+    }
+  }
+
+  std::vector<Box> &_boxes;
+  const std::vector<Box> *_children;
+  const std::vector<Eigen::Vector3d> &_sources;
+  const std::vector<std::complex<double> > &_strengths;
+  double _k;
+  int _p;
+};
+
+
+// Local expansions of one level, from the parent's and the far field
+struct MultipoleTree::DownwardPass {
+  DownwardPass(std::vector<Box> &boxes, const std::vector<Box> *parents)
+  : _boxes(boxes), _parents(parents) {}
+
+  void operator()(size_t begin, size_t end) const {
+    for (size_t b = begin; b < end; b++) {
+      Box &box = _boxes[b];
+      if (box.numListeners == 0) continue;
+
+      box.L.setZero();
+      if (_parents != NULL) {
+        box.fromParent->apply((*_parents)[box.parent].L, box.L);
+      }
+      for (size_t f = 0; f < box.farBoxes.size(); f++) {
+        box.farTranslations[f]->apply(_boxes[box.farBoxes[f]].M, box.L);
+      }
+    }
+  }
+
+  std::vector<Box> &_boxes;
+  const std::vector<Box> *_parents;
+};
+
+
+void MultipoleTree::upward(const std::vector<std::complex<double> > &strengths, size_t nthreads) {
+
+  parallelFor(_levels[_leafLevel].size(),
+              UpwardPass(_levels[_leafLevel], NULL, _sources, strengths, _k, _p[_leafLevel]),
+              nthreads);
+
+  for (int level = _leafLevel - 1; level >= _topLevel; level--) {
+    parallelFor(_levels[level].size(),
+                UpwardPass(_levels[level], &_levels[level + 1], _sources, strengths, _k, _p[level]),
+                nthreads);
+  }
+}
+
+
+void MultipoleTree::downward(size_t nthreads) {
+
+  for (int level = _topLevel; level <= _leafLevel; level++) {
+    parallelFor(_levels[level].size(),
+                DownwardPass(_levels[level], level > _topLevel ? &_levels[level - 1] : NULL),
+                nthreads);
+  }
+}
+
+
+void MultipoleTree::EvaluateLeaves::operator()(size_t begin, size_t end) const {
+
+  const std::vector<Box> &leaves = _tree._levels[_tree._leafLevel];
+  bool local = _tree._topLevel <= _tree._leafLevel;
+  int p = _tree._p[_tree._leafLevel];
+
+  for (size_t b = begin; b < end; b++) {
+    const Box &box = leaves[b];
+
+    for (size_t i = 0; i < box.listeners.size(); i++) {
+      size_t j = box.listeners[i];
+      const Eigen::Vector3d &x = _tree._listeners[j];
+
+      std::complex<double> sum = 0;
+      if (local) {
+        sum += MultipoleTools::evaluateLocal(_tree._k, p, box.L, x - box.center);
+      }
+
+      for (size_t n = 0; n < box.nearBoxes.size(); n++) {
+        const Box &near = leaves[box.nearBoxes[n]];
+        for (size_t s = 0; s < near.sources.size(); s++) {
+          size_t src = near.sources[s];
+          sum += _strengths[src] * _tree.green(x - _tree._sources[src]);
+        }
+      }
+
+      _pressures[j] = sum;
+    }
+  }
+}
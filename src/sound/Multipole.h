@@ -0,0 +1,624 @@
+//
+//  Multipole.h
+//  aletler
+//
+//  Fast evaluation of the field of many monopoles,
+//
+//      p(x) = sum_i q_i G(x - y_i),     G(r) = e^{ik|r|} / (4 pi |r|)
+//
+//  at many listening points, by a fast multipole method for the Helmholtz
+//  equation at one wavenumber k. Everything is built on the addition
+//  theorem (Gumerov & Duraiswami (2.2.3), pg 71), for |a| < |b|:
+//
+//      G(b - a) = ik sum_{n,m} S_n^{-m}(b) R_n^m(a)
+//
+//  so the field of sources close to a center c is, far from c, a multipole
+//  expansion sum M_n^m S_n^m(x - c), and the field of sources far from c is,
+//  close to c, a local expansion sum L_n^m R_n^m(x - c).
+//
+//  MultipoleTranslation re-expands one of these about another center
+//  (multipole-to-multipole, multipole-to-local, local-to-local) by rotating
+//  the shift onto the z axis, translating along it and rotating back, which
+//  is O(p^3) for degree p. The rotations and the translations along z are
+//  found by sampling the input expansion on a sphere and projecting onto
+//  the spherical harmonics there, once per distinct direction / distance;
+//  an octree only has a few dozen of each per level.
+//
+//  MultipoleTree groups the sources and listeners in an octree and
+//  evaluates the sum in O(N + M) for N sources and M listeners. The tree
+//  and its translations only depend on the positions, so a new set of
+//  strengths (e.g. the bubble amplitudes at the next time step) costs one
+//  more call to evaluate. A Monopole of unit amplitude has strength
+//  q = -i k c rho, see Monopole::pressure.
+//
+
+#ifndef aletler_Multipole_h
+#define aletler_Multipole_h
+
+#include <vector>
+#include <map>
+#include <complex>
+#include <cmath>
+#include <algorithm>
+#include <memory>
+
+#include <Eigen/Dense>
+
+#include <numeric/ParallelFor.h>
+#include "SphericalTools.h"
+
+
+typedef Eigen::VectorXcd MultipoleCoefficients;
+
+
+class MultipoleTools {
+
+public:
+
+  // Coefficients of an expansion truncated after degree p
+  static int numTerms(int p) { return (p + 1) * (p + 1); }
+
+  // Adds a source of strength q at y - c to the multipole expansion about c
+  static void addSourceToMultipole(double k, int p, const Eigen::Vector3d &rel,
+                                   std::complex<double> q, MultipoleCoefficients &M) {
+    std::vector<std::complex<double> > r(numTerms(p));
+    SphericalTools::R_all(p, k, rel, &r[0]);
+
+    std::complex<double> ikq = ii * k * q;
+    for (int n = 0; n <= p; n++) {
+      for (int m = -n; m <= n; m++) {
+        M[SphericalTools::index(m, n)] += ikq * r[SphericalTools::index(-m, n)];
+      }
+    }
+  }
+
+  // Adds a source of strength q at y - c to the local expansion about c
+  static void addSourceToLocal(double k, int p, const Eigen::Vector3d &rel,
+                               std::complex<double> q, MultipoleCoefficients &L) {
+    std::vector<std::complex<double> > s(numTerms(p));
+    SphericalTools::S_all(p, k, rel, &s[0]);
+
+    std::complex<double> ikq = ii * k * q;
+    for (int n = 0; n <= p; n++) {
+      for (int m = -n; m <= n; m++) {
+        L[SphericalTools::index(m, n)] += ikq * s[SphericalTools::index(-m, n)];
+      }
+    }
+  }
+
+  // Field of a multipole expansion about c at x, with rel = x - c
+  static std::complex<double> evaluateMultipole(double k, int p, const MultipoleCoefficients &M,
+                                                const Eigen::Vector3d &rel) {
+    std::vector<std::complex<double> > s(numTerms(p));
+    SphericalTools::S_all(p, k, rel, &s[0]);
+    return dotBasis(M, s);
+  }
+
+  // Field of a local expansion about c at x, with rel = x - c
+  static std::complex<double> evaluateLocal(double k, int p, const MultipoleCoefficients &L,
+                                            const Eigen::Vector3d &rel) {
+    std::vector<std::complex<double> > r(numTerms(p));
+    SphericalTools::R_all(p, k, rel, &r[0]);
+    return dotBasis(L, r);
+  }
+
+  // Truncation degree for expansions of sources within a ball of the given
+  // radius, accurate to about 'digits' digits over MultipoleTree's
+  // interaction lists (the usual kr + O((kr)^(1/3)) rule, with the constant
+  // fitted on random clouds, and a floor for low frequencies)
+  static int truncation(double k, double radius, double digits = 3, int pmin = 6) {
+    double kr = k * radius;
+    int p = int(ceil(kr + 1.8 * pow(digits, 2.0 / 3.0) * pow(kr, 1.0 / 3.0)));
+    return std::max(p, pmin);
+  }
+
+  // Gauss-Legendre nodes and weights on [-1, 1], by Newton's method
+  static void gaussLegendre(int n, std::vector<double> &x, std::vector<double> &w) {
+
+    x.resize(n);
+    w.resize(n);
+
+    for (int i = 0; i < (n + 1) / 2; i++) {
+
+      double z = cos(M_PI * (i + 0.75) / (n + 0.5));
+      double dp = 1;
+
+      for (int iter = 0; iter < 100; iter++) {
+        double p0 = 1, p1 = z;
+        for (int j = 2; j <= n; j++) {
+          double p2 = ((2.0 * j - 1) * z * p1 - (j - 1.0) * p0) / j;
+          p0 = p1;
+          p1 = p2;
+        }
+        if (n == 1) p0 = 1;
+        dp = n * (z * p1 - p0) / (z * z - 1);
+        double dz = p1 / dp;
+        z -= dz;
+        if (fabs(dz) < 1e-15) break;
+      }
+
+      x[i] = -z;
+      x[n - 1 - i] = z;
+      w[i] = w[n - 1 - i] = 2 / ((1 - z * z) * dp * dp);
+    }
+  }
+
+private:
+
+  static std::complex<double> dotBasis(const MultipoleCoefficients &c,
+                                       const std::vector<std::complex<double> > &basis) {
+    std::complex<double> sum = 0;
+    for (size_t i = 0; i < basis.size(); i++) {
+      sum += c[i] * basis[i];
+    }
+    return sum;
+  }
+};
+
+
+enum MultipoleTranslationKind {
+  MULTIPOLE_TO_MULTIPOLE,
+  MULTIPOLE_TO_LOCAL,
+  LOCAL_TO_LOCAL
+};
+
+
+// Rotation of expansion coefficients into a frame whose z axis has polar
+// angle theta (and azimuth 0) in the original one. Each degree n is rotated
+// on its own by a real (2n+1) x (2n+1) matrix d_n, found by projecting the
+// rotated harmonics back onto the harmonics; the quadrature is exact for
+// these, so the d_n are exact up to round-off.
+class SphericalRotation {
+
+public:
+
+  SphericalRotation(int p, double theta) : _p(p), _d(p + 1) {
+
+    int nterms = MultipoleTools::numTerms(p);
+    int nTheta = p + 1;
+    int nPhi = 2 * p + 2;
+    int nPoints = nTheta * nPhi;
+
+    std::vector<double> mu, muWeights;
+    MultipoleTools::gaussLegendre(nTheta, mu, muWeights);
+
+    // rows are sample directions s: Y(s) weighted, and Y(R_y(theta) s)
+    Eigen::MatrixXcd weighted(nPoints, nterms), rotated(nPoints, nterms);
+    std::vector<std::complex<double> > y(nterms);
+
+    double ct = cos(theta), st = sin(theta);
+
+    for (int i = 0; i < nTheta; i++) {
+      double th = acos(mu[i]);
+      for (int j = 0; j < nPhi; j++) {
+        double ph = 2 * M_PI * j / nPhi;
+        int q = i * nPhi + j;
+        double wq = muWeights[i] * 2 * M_PI / nPhi;
+
+        SphericalTools::Y_all(p, th, ph, &y[0]);
+        for (int t = 0; t < nterms; t++) {
+          weighted(q, t) = wq * y[t];
+        }
+
+        Eigen::Vector3d s(sin(th) * cos(ph), sin(th) * sin(ph), mu[i]);
+        Eigen::Vector3d r(ct * s[0] + st * s[2], s[1], -st * s[0] + ct * s[2]);
+        SphericalTools::Y_all(p, acos(std::max(-1.0, std::min(1.0, r[2]))), atan2(r[1], r[0]), &y[0]);
+        for (int t = 0; t < nterms; t++) {
+          rotated(q, t) = y[t];
+        }
+      }
+    }
+
+    for (int n = 0; n <= p; n++) {
+      int first = n * n, size = 2 * n + 1;
+      _d[n] = (weighted.middleCols(first, size).adjoint() * rotated.middleCols(first, size)).real();
+    }
+  }
+
+  int degree() const { return _p; }
+
+  // out = D c for degrees 0 .. p, or D^T c if inverse (p <= degree())
+  void apply(const std::complex<double> *c, std::complex<double> *out, int p, bool inverse) const {
+    for (int n = 0; n <= p; n++) {
+      int first = n * n, size = 2 * n + 1;
+
+      // D is real, so it acts on the real and imaginary parts (the rows
+      // of these 2 x size views) separately
+      Eigen::Map<const Eigen::MatrixXd> cn(reinterpret_cast<const double *>(c + first), 2, size);
+      Eigen::Map<Eigen::MatrixXd> on(reinterpret_cast<double *>(out + first), 2, size);
+      if (inverse) {
+        on.noalias() = cn * _d[n];
+      } else {
+        on.noalias() = cn * _d[n].transpose();
+      }
+    }
+  }
+
+private:
+  int _p;
+  std::vector<Eigen::MatrixXd> _d;
+};
+
+
+// Translation by distance along +z, from a degree pIn expansion to a degree
+// pOut one. It keeps the order m, so it is one (pOut+1-|m|) x (pIn+1-|m|)
+// block per m. The blocks are found by sampling the input on a sphere of the
+// given radius about the new center and projecting; around the z axis the
+// projection is done in closed form, leaving a one-dimensional quadrature.
+class CoaxialTranslation {
+
+public:
+
+  // radius must enclose the sources for MULTIPOLE_TO_MULTIPOLE, and stay
+  // clear of them for MULTIPOLE_TO_LOCAL
+  CoaxialTranslation(MultipoleTranslationKind kind, double k, int pIn, int pOut,
+                     double distance, double radius)
+  : _pIn(pIn), _pOut(pOut), _blocks(2 * std::min(pIn, pOut) + 1) {
+
+    int mmax = std::min(pIn, pOut);
+    int nIn = MultipoleTools::numTerms(pIn);
+    int nOut = MultipoleTools::numTerms(pOut);
+
+    int nTheta = pIn + pOut + 2;
+    std::vector<double> mu, muWeights;
+    MultipoleTools::gaussLegendre(nTheta, mu, muWeights);
+
+    // Local expansions are projected on two spheres and combined by least
+    // squares, since j_n(k radius) alone may vanish
+    int nRadii = (kind == MULTIPOLE_TO_MULTIPOLE) ? 1 : 2;
+    double radii[2] = {radius, 0.75 * radius};
+
+    std::vector<Eigen::MatrixXcd> projected(_blocks.size());
+    for (int m = -mmax; m <= mmax; m++) {
+      _blocks[m + mmax] = Eigen::MatrixXcd::Zero(pOut + 1 - abs(m), pIn + 1 - abs(m));
+    }
+    std::vector<double> norms(pOut + 1, 0.0);
+
+    std::vector<std::complex<double> > b(nIn), y(nOut), radial(pOut + 1);
+
+    for (int r = 0; r < nRadii; r++) {
+
+      for (int m = -mmax; m <= mmax; m++) {
+        projected[m + mmax] = Eigen::MatrixXcd::Zero(pOut + 1 - abs(m), pIn + 1 - abs(m));
+      }
+
+      for (int i = 0; i < nTheta; i++) {
+        double th = acos(mu[i]);
+        Eigen::Vector3d rel(radii[r] * sin(th), 0, radii[r] * mu[i] + distance);
+
+        if (kind == LOCAL_TO_LOCAL) {
+          SphericalTools::R_all(pIn, k, rel, &b[0]);
+        } else {
+          SphericalTools::S_all(pIn, k, rel, &b[0]);
+        }
+        SphericalTools::Y_all(pOut, th, 0, &y[0]);
+
+        double wi = 2 * M_PI * muWeights[i];
+        for (int m = -mmax; m <= mmax; m++) {
+          Eigen::MatrixXcd &block = projected[m + mmax];
+          for (int no = abs(m); no <= pOut; no++) {
+            std::complex<double> yw = wi * std::conj(y[SphericalTools::index(m, no)]);
+            for (int ni = abs(m); ni <= pIn; ni++) {
+              block(no - abs(m), ni - abs(m)) += yw * b[SphericalTools::index(m, ni)];
+            }
+          }
+        }
+      }
+
+      if (kind == MULTIPOLE_TO_MULTIPOLE) {
+        SphericalTools::h_all(pOut, k * radii[r], &radial[0]);
+      } else {
+        SphericalTools::j_all(pOut, k * radii[r], &radial[0]);
+      }
+
+      for (int m = -mmax; m <= mmax; m++) {
+        for (int no = abs(m); no <= pOut; no++) {
+          _blocks[m + mmax].row(no - abs(m)) += std::conj(radial[no]) * projected[m + mmax].row(no - abs(m));
+        }
+      }
+      for (int n = 0; n <= pOut; n++) {
+        norms[n] += std::norm(radial[n]);
+      }
+    }
+
+    for (int m = -mmax; m <= mmax; m++) {
+      for (int no = abs(m); no <= pOut; no++) {
+        if (norms[no] > 1e-300) {
+          _blocks[m + mmax].row(no - abs(m)) /= norms[no];
+        } else {
+          _blocks[m + mmax].row(no - abs(m)).setZero();
+        }
+      }
+    }
+  }
+
+  int inputDegree() const { return _pIn; }
+  int outputDegree() const { return _pOut; }
+
+  // out = T c, both indexed by SphericalTools::index
+  void apply(const std::complex<double> *c, std::complex<double> *out) const {
+
+    std::fill(out, out + MultipoleTools::numTerms(_pOut), std::complex<double>(0, 0));
+
+    int mmax = std::min(_pIn, _pOut);
+    for (int m = -mmax; m <= mmax; m++) {
+      const Eigen::MatrixXcd &block = _blocks[m + mmax];
+      for (int no = abs(m); no <= _pOut; no++) {
+        std::complex<double> sum = 0;
+        for (int ni = abs(m); ni <= _pIn; ni++) {
+          sum += block(no - abs(m), ni - abs(m)) * c[SphericalTools::index(m, ni)];
+        }
+        out[SphericalTools::index(m, no)] = sum;
+      }
+    }
+  }
+
+private:
+  int _pIn, _pOut;
+  std::vector<Eigen::MatrixXcd> _blocks;
+};
+
+
+// Re-expansion of a degree pIn expansion about c_in as a degree pOut
+// expansion about c_out = c_in + shift: rotate the shift onto the z axis,
+// translate along it, and rotate back, for O(p^3) work instead of O(p^4).
+// The rotation and the coaxial part are shared, since they only depend on
+// the direction and on the distance respectively.
+class MultipoleTranslation {
+
+public:
+
+  MultipoleTranslation() : _phi(0) {}
+
+  // radius is that of the sphere (about c_out) on which the input is
+  // sampled. It must enclose the sources for MULTIPOLE_TO_MULTIPOLE, and
+  // stay clear of them for MULTIPOLE_TO_LOCAL.
+  MultipoleTranslation(MultipoleTranslationKind kind, double k, int pIn, int pOut,
+                       const Eigen::Vector3d &shift, double radius) {
+    double theta, phi;
+    direction(shift, theta, phi);
+    _rotation.reset(new SphericalRotation(std::max(pIn, pOut), theta));
+    _coaxial.reset(new CoaxialTranslation(kind, k, pIn, pOut, shift.norm(), radius));
+    _phi = phi;
+    setPhases();
+  }
+
+  MultipoleTranslation(const std::shared_ptr<const SphericalRotation> &rotation,
+                       const std::shared_ptr<const CoaxialTranslation> &coaxial,
+                       double phi)
+  : _rotation(rotation), _coaxial(coaxial), _phi(phi) {
+    setPhases();
+  }
+
+  // Polar and azimuthal angles of a shift
+  static void direction(const Eigen::Vector3d &shift, double &theta, double &phi) {
+    double r = shift.norm();
+    theta = (r > 0) ? acos(std::max(-1.0, std::min(1.0, shift[2] / r))) : 0;
+    phi = atan2(shift[1], shift[0]);
+  }
+
+  // out += T in. Safe to call from several threads at once.
+  void apply(const MultipoleCoefficients &in, MultipoleCoefficients &out) const {
+
+    int pIn = _coaxial->inputDegree();
+    int pOut = _coaxial->outputDegree();
+
+    int nterms = MultipoleTools::numTerms(std::max(pIn, pOut));
+    MultipoleCoefficients a(nterms), b(nterms);
+
+    // azimuth to 0
+    for (int n = 0; n <= pIn; n++) {
+      for (int m = -n; m <= n; m++) {
+        int t = SphericalTools::index(m, n);
+        a[t] = in[t] * phase(m);
+      }
+    }
+
+    _rotation->apply(a.data(), b.data(), pIn, false);
+    _coaxial->apply(b.data(), a.data());
+    _rotation->apply(a.data(), b.data(), pOut, true);
+
+    for (int n = 0; n <= pOut; n++) {
+      for (int m = -n; m <= n; m++) {
+        int t = SphericalTools::index(m, n);
+        out[t] += b[t] * std::conj(phase(m));
+      }
+    }
+  }
+
+private:
+  std::shared_ptr<const SphericalRotation> _rotation;
+  std::shared_ptr<const CoaxialTranslation> _coaxial;
+  double _phi;
+
+  // e^{i m phi} for m = 0 .. p
+  std::vector<std::complex<double> > _phases;
+
+  void setPhases() {
+    int p = std::max(_coaxial->inputDegree(), _coaxial->outputDegree());
+    _phases.resize(p + 1);
+    for (int m = 0; m <= p; m++) {
+      _phases[m] = std::polar(1.0, m * _phi);
+    }
+  }
+
+  std::complex<double> phase(int m) const {
+    return m >= 0 ? _phases[m] : std::conj(_phases[-m]);
+  }
+};
+
+
+class MultipoleTree {
+
+public:
+
+  // Octree over sources and listeners for wavenumber k, subdivided until a
+  // leaf holds about leafSize sources. pmax caps the truncation degree: the
+  // levels whose boxes would need more are left to the finer ones, which
+  // then exchange expansions with every box that is not a neighbour. This
+  // is a low-frequency method: once k times the size of the cloud gets
+  // past a few tens, direct summation is faster.
+  MultipoleTree(double k,
+                const std::vector<Eigen::Vector3d> &sources,
+                const std::vector<Eigen::Vector3d> &listeners,
+                size_t leafSize = 32, int pmax = 30, double digits = 3)
+  : _k(k), _sources(sources), _listeners(listeners) {
+
+    buildBoxes(leafSize);
+    chooseLevels(pmax, digits);
+    buildInteractions();
+  }
+
+  size_t numSources() const { return _sources.size(); }
+  size_t numListeners() const { return _listeners.size(); }
+
+  int depth() const { return _leafLevel; }
+
+  // Coarsest level with expansions (past the leaves if everything is near)
+  int topLevel() const { return _topLevel; }
+
+  int truncation(int level) const { return _p[level]; }
+
+  size_t numTranslations() const { return _translations.size(); }
+
+  // pressures[j] = sum_i strengths[i] G(listener_j - source_i), leaving out
+  // coincident points. nthreads = 0 means one per core.
+  void evaluate(const std::vector<std::complex<double> > &strengths,
+                std::vector<std::complex<double> > &pressures,
+                size_t nthreads = 0) {
+
+    pressures.assign(_listeners.size(), std::complex<double>(0, 0));
+
+    if (_topLevel <= _leafLevel) {
+      upward(strengths, nthreads);
+      downward(nthreads);
+    }
+
+    parallelFor(_levels[_leafLevel].size(),
+                EvaluateLeaves(*this, strengths, pressures), nthreads);
+  }
+
+  // Same, one listener at a time, for checking
+  void evaluateDirect(const std::vector<std::complex<double> > &strengths,
+                      std::vector<std::complex<double> > &pressures) const {
+    pressures.assign(_listeners.size(), std::complex<double>(0, 0));
+    for (size_t j = 0; j < _listeners.size(); j++) {
+      for (size_t i = 0; i < _sources.size(); i++) {
+        pressures[j] += strengths[i] * green(_listeners[j] - _sources[i]);
+      }
+    }
+  }
+
+private:
+
+  static const int MAX_DEPTH = 10;
+
+  struct Box {
+    int ix, iy, iz;
+    Eigen::Vector3d center;
+    long parent;
+    std::vector<size_t> children;
+
+    // leaves only
+    std::vector<size_t> sources, listeners;
+
+    size_t numSources, numListeners;
+
+    MultipoleCoefficients M, L;
+
+    // far-field partners of this box at its level, with the translation
+    // from their multipole expansions to its local expansion
+    std::vector<size_t> farBoxes;
+    std::vector<const MultipoleTranslation *> farTranslations;
+
+    // leaves only: neighbouring leaves (itself included) that have sources
+    std::vector<size_t> nearBoxes;
+
+    const MultipoleTranslation *toParent, *fromParent;
+  };
+
+  double _k;
+  std::vector<Eigen::Vector3d> _sources, _listeners;
+
+  Eigen::Vector3d _corner;
+  double _size;
+
+  int _leafLevel, _topLevel;
+  std::vector<int> _p;
+
+  std::vector<std::vector<Box> > _levels;
+  std::vector<std::map<unsigned long long, size_t> > _lookup;
+
+  std::map<unsigned long long, MultipoleTranslation> _translations;
+  std::map<unsigned long long, std::shared_ptr<const SphericalRotation> > _rotations;
+  std::map<unsigned long long, std::shared_ptr<const CoaxialTranslation> > _coaxials;
+
+
+  std::complex<double> green(const Eigen::Vector3d &r) const {
+    if (r.squaredNorm() == 0) return 0;
+    return SphericalTools::Greens(_k, r);
+  }
+
+  static unsigned long long boxKey(int ix, int iy, int iz) {
+    return ((unsigned long long)ix << 40) | ((unsigned long long)iy << 20) | (unsigned long long)iz;
+  }
+
+  double halfWidth(int level) const { return 0.5 * _size / double(1 << level); }
+
+  // radius of the ball around a box center that contains the box
+  double boxRadius(int level) const { return sqrt(3.0) * halfWidth(level); }
+
+  long findBox(int level, int ix, int iy, int iz) const {
+    std::map<unsigned long long, size_t>::const_iterator it = _lookup[level].find(boxKey(ix, iy, iz));
+    return it == _lookup[level].end() ? -1 : long(it->second);
+  }
+
+  size_t boxAt(int level, int ix, int iy, int iz) {
+    long b = findBox(level, ix, iy, iz);
+    if (b >= 0) return size_t(b);
+
+    Box box;
+    box.ix = ix;
+    box.iy = iy;
+    box.iz = iz;
+    double w = _size / double(1 << level);
+    box.center = _corner + w * Eigen::Vector3d(ix + 0.5, iy + 0.5, iz + 0.5);
+    box.parent = -1;
+    box.numSources = box.numListeners = 0;
+    box.toParent = box.fromParent = NULL;
+
+    _levels[level].push_back(box);
+    _lookup[level][boxKey(ix, iy, iz)] = _levels[level].size() - 1;
+    return _levels[level].size() - 1;
+  }
+
+  void buildBoxes(size_t leafSize);
+  void chooseLevels(int pmax, double digits);
+  void buildInteractions();
+  const MultipoleTranslation *translation(MultipoleTranslationKind kind, int levelIn, int levelOut,
+                                          const Box &in, const Box &out);
+
+  void upward(const std::vector<std::complex<double> > &strengths, size_t nthreads);
+  void downward(size_t nthreads);
+
+  struct UpwardPass;
+  struct DownwardPass;
+
+  // Near field and local expansions, for the listeners of a range of leaves
+  struct EvaluateLeaves {
+    EvaluateLeaves(const MultipoleTree &tree,
+                   const std::vector<std::complex<double> > &strengths,
+                   std::vector<std::complex<double> > &pressures)
+    : _tree(tree), _strengths(strengths), _pressures(pressures) {}
+    void operator()(size_t begin, size_t end) const;
+    const MultipoleTree &_tree;
+    const std::vector<std::complex<double> > &_strengths;
+    std::vector<std::complex<double> > &_pressures;
+  };
+
+  // not copyable (boxes point into _translations)
+  MultipoleTree(const MultipoleTree &);
+  MultipoleTree &operator=(const MultipoleTree &);
+};
+
+#endif
@@ -0,0 +1,271 @@
+//
+//  OscillatorBank.h
+//  aletler
+//
+//  Renders many independent damped oscillators (one per bubble) straight
+//  into an output buffer, one oscillator per lane of an OscillatorLanes.
+//
+//  Its oscillators have constant frequency, damping and gain between calls
+//  to retune. Fluid::mixdownBank renders all the bubbles with one bank,
+//  retuning the sounding ones every few samples from their keyframes,
+//  instead of integrating each bubble into its own samples first.
+//
+//  Oscillators that have not started yet wait in a queue sorted by birth
+//  sample, and finished ones are dropped from the active lanes by moving the
+//  last active lane into their place, so the cost of a block only depends on
+//  the number of bubbles sounding during it.
+//
+
+#ifndef aletler_OscillatorBank_h
+#define aletler_OscillatorBank_h
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+#include <physics/PhysicalConstants.h>
+
+#include "OscillatorLanes.h"
+
+// lane index of an oscillator that is not sounding
+static const size_t OSCBANK_NOT_ACTIVE = size_t(-1);
+
+
+class OscillatorBank {
+
+public:
+
+  OscillatorBank(double sampleRate = PhysicalConstants::Sound::SAMPLING_RATE)
+  : _sampleRate(sampleRate), _position(0), _numActive(0), _nextPending(0), _pendingSorted(true) {}
+
+  // Preallocates room for n oscillators in total and n sounding at once,
+  // so that addOscillator and render do not allocate.
+  void reserve(size_t n) {
+    _oscs.reserve(n);
+    _pending.reserve(n);
+    _laneOf.reserve(n);
+    growLanes(n);
+  }
+
+  // Adds an oscillator x'' + beta x' + omega^2 x = 0 that starts from (x0, v0)
+  // at sample birthSample and is heard for numSamples samples, scaled by gain.
+  // A birth before position() is moved to position(). Returns an id for retune.
+  size_t addOscillator(size_t birthSample, size_t numSamples,
+                       double omega, double beta, double gain = 1,
+                       double x0 = 0, double v0 = -1) {
+
+    Oscillator o;
+    o.birth = std::max(birthSample, _position);
+    o.length = numSamples;
+    o.omega = omega;
+    o.beta = beta;
+    o.gain = gain;
+    o.x0 = x0;
+    o.v0 = v0;
+
+    size_t id = _oscs.size();
+    _oscs.push_back(o);
+    _laneOf.push_back(OSCBANK_NOT_ACTIVE);
+
+    if (_pendingSorted && _nextPending < _pending.size()
+        && _oscs[_pending.back()].birth > o.birth) {
+      _pendingSorted = false;
+    }
+    _pending.push_back(id);
+
+    return id;
+  }
+
+  // Changes the frequency and damping of an oscillator from the next call
+  // to render on (e.g. at every animation frame).
+  void retune(size_t id, double omega, double beta) {
+    _oscs[id].omega = omega;
+    _oscs[id].beta = beta;
+
+    size_t lane = _laneOf[id];
+    if (lane != OSCBANK_NOT_ACTIVE) {
+      setLaneStep(lane, omega, beta);
+    }
+  }
+
+  // Same, and changes the gain too
+  void retune(size_t id, double omega, double beta, double gain) {
+    _oscs[id].gain = gain;
+
+    size_t lane = _laneOf[id];
+    if (lane != OSCBANK_NOT_ACTIVE) {
+      _lanes.setGain(lane, 0, gain);
+    }
+    retune(id, omega, beta);
+  }
+
+  // Adds samples position() .. position() + n - 1 of the mix to out[0 .. n-1]
+  void render(double *out, size_t n) {
+
+    sortPending();
+
+    for (size_t done = 0; done < n; ) {
+
+      size_t len = std::min(n - done, size_t(BLOCK));
+
+      admit(_position + len);
+
+      double *channel = out + done;
+      _lanes.render(_numActive, _position, len, &channel);
+
+      _position += len;
+      done += len;
+
+      retire();
+    }
+  }
+
+  // Index of the next sample that render will produce
+  size_t position() const { return _position; }
+
+  size_t numActive() const { return _numActive; }
+  size_t numPending() const { return _pending.size() - _nextPending; }
+
+  bool finished() const { return _numActive == 0 && numPending() == 0; }
+
+  // Removes all oscillators and rewinds to sample 0, keeping the allocations
+  void clear() {
+    _oscs.clear();
+    _pending.clear();
+    _laneOf.clear();
+    for (size_t i = 0; i < _numActive; i++) {
+      clearLane(i);
+    }
+    _position = 0;
+    _numActive = 0;
+    _nextPending = 0;
+    _pendingSorted = true;
+  }
+
+  // Number of samples until the envelope exp(-beta t / 2) falls to ratio
+  static size_t decayLength(double beta, double sampleRate, double ratio = 1e-3) {
+    if (beta <= 0) return std::numeric_limits<size_t>::max();
+    return size_t(ceil(-2 * log(ratio) / beta * sampleRate));
+  }
+
+private:
+
+  static const size_t BLOCK = 256;
+
+  struct Oscillator {
+    size_t birth, length;
+    double omega, beta, gain;
+    double x0, v0;
+  };
+
+  struct BirthOrder {
+    BirthOrder(const std::vector<Oscillator> &oscs) : _oscs(oscs) {}
+    bool operator()(size_t a, size_t b) const {
+      if (_oscs[a].birth != _oscs[b].birth) return _oscs[a].birth < _oscs[b].birth;
+      return a < b;
+    }
+    const std::vector<Oscillator> &_oscs;
+  };
+
+  void sortPending() {
+    if (_pendingSorted) return;
+    std::sort(_pending.begin() + _nextPending, _pending.end(), BirthOrder(_oscs));
+    _pendingSorted = true;
+  }
+
+  // Moves every pending oscillator born before sample 'until' into a lane
+  void admit(size_t until) {
+
+    while (_nextPending < _pending.size() && _oscs[_pending[_nextPending]].birth < until) {
+
+      size_t id = _pending[_nextPending++];
+      const Oscillator &o = _oscs[id];
+
+      if (o.length == 0) continue;
+
+      if (_numActive == _ids.size()) {
+        growLanes(_numActive + 1);
+      }
+
+      size_t lane = _numActive++;
+      _ids[lane] = id;
+      _laneOf[id] = lane;
+
+      _lanes.x(lane) = o.x0;
+      _lanes.v(lane) = o.v0;
+      _lanes.setGain(lane, 0, o.gain);
+      _lanes.setInterval(lane, double(o.birth), double(o.birth) + double(o.length));
+      setLaneStep(lane, o.omega, o.beta);
+    }
+
+    if (_nextPending == _pending.size()) {
+      _pending.clear();
+      _nextPending = 0;
+    }
+  }
+
+  // Drops the oscillators that ended before position(), filling the holes
+  // with the last active lanes
+  void retire() {
+
+    double now = double(_position);
+
+    for (size_t lane = 0; lane < _numActive; ) {
+
+      if (_lanes.end(lane) > now) {
+        lane++;
+        continue;
+      }
+
+      _laneOf[_ids[lane]] = OSCBANK_NOT_ACTIVE;
+
+      size_t last = --_numActive;
+      if (lane != last) {
+        moveLane(last, lane);
+        _laneOf[_ids[lane]] = lane;
+      }
+      clearLane(last);
+    }
+  }
+
+  void setLaneStep(size_t lane, double omega, double beta) {
+    _lanes.setStep(lane, omega, beta, 1.0 / _sampleRate);
+  }
+
+  // Makes room for at least n lanes
+  void growLanes(size_t n) {
+    _lanes.grow(n);
+    _ids.resize(_lanes.size(), OSCBANK_NOT_ACTIVE);
+  }
+
+  void moveLane(size_t from, size_t to) {
+    _lanes.move(from, to);
+    _ids[to] = _ids[from];
+  }
+
+  void clearLane(size_t lane) {
+    _lanes.clear(lane);
+    _ids[lane] = OSCBANK_NOT_ACTIVE;
+  }
+
+  double _sampleRate;
+  size_t _position;
+
+  // every oscillator ever added, indexed by id
+  std::vector<Oscillator> _oscs;
+  std::vector<size_t> _laneOf;
+
+  // ids of the oscillators not admitted yet, sorted by birth from _nextPending on
+  std::vector<size_t> _pending;
+  size_t _numActive, _nextPending;
+  bool _pendingSorted;
+
+  // the lanes: [0, _numActive) are sounding, the rest (up to a whole
+  // number of groups) are silent padding. _ids has the id in each lane.
+  OscillatorLanes _lanes;
+  std::vector<size_t> _ids;
+};
+
+
+#endif
@@ -0,0 +1,278 @@
+//
+//  OscillatorLanes.h
+//  aletler
+//
+//  The state of a set of damped oscillators in structure-of-arrays lanes,
+//  padded to groups of OSCBANK_LANES, and the kernel that steps them. This
+//  is the engine shared by OscillatorBank (offline, one output) and
+//  RealtimeEngine (a fixed pool of voices heard at several ears), which
+//  differ only in how oscillators come and go.
+//
+//  Each lane has an exact propagator (DampedOscillatorStep), the interval
+//  of samples [begin, end) it sounds in, and a gain per output channel:
+//  channel c hears gx[c] x + gv[c] x'. Outside its interval a lane neither
+//  moves nor makes a sound. A group is stepped one sample at a time with a
+//  fixed-length, branch-free inner loop over its lanes, and every lane adds
+//  into its own accumulator, so the loop is element-wise and the compiler
+//  can vectorize it without reassociating any sums; the lanes are added
+//  together once per block.
+//
+
+#ifndef aletler_OscillatorLanes_h
+#define aletler_OscillatorLanes_h
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+#include <numeric/DampedOscillator.h>
+
+// Lanes per group. Keep it a multiple of the widest SIMD register (in doubles).
+#define OSCBANK_LANES 8
+
+
+class OscillatorLanes {
+
+public:
+
+  // Lanes heard at numChannels outputs. Without velocityGains, gv is
+  // ignored (taken as 0), which saves a multiply-add per lane and sample.
+  OscillatorLanes(size_t numChannels = 1, bool velocityGains = false)
+  : _numChannels(numChannels), _velocityGains(velocityGains),
+    _gx(numChannels), _gv(numChannels),
+    _mix(numChannels * BLOCK * OSCBANK_LANES), _history(2 * BLOCK * OSCBANK_LANES) {}
+
+  size_t numChannels() const { return _numChannels; }
+
+  // Number of lanes, a whole number of groups
+  size_t size() const { return _x.size(); }
+
+  // Makes room for at least n lanes, rounded up to whole groups. New lanes
+  // are silent (zero gains, empty interval).
+  void grow(size_t n) {
+
+    size_t lanes = (n + OSCBANK_LANES - 1) / OSCBANK_LANES * OSCBANK_LANES;
+    if (lanes <= size()) return;
+
+    // grow geometrically so that adding one at a time stays cheap
+    lanes = std::max(lanes, 2 * size());
+
+    _x.resize(lanes, 0);
+    _v.resize(lanes, 0);
+    _m00.resize(lanes, 1);
+    _m01.resize(lanes, 0);
+    _m10.resize(lanes, 0);
+    _m11.resize(lanes, 1);
+    _begin.resize(lanes, 0);
+    _end.resize(lanes, 0);
+    for (size_t c = 0; c < _numChannels; c++) {
+      _gx[c].resize(lanes, 0);
+      _gv[c].resize(lanes, 0);
+    }
+  }
+
+  // State (x, x') of a lane
+  double &x(size_t lane) { return _x[lane]; }
+  double &v(size_t lane) { return _v[lane]; }
+
+  // Propagator of a lane over a step h, for x'' + beta x' + omega^2 x = 0
+  void setStep(size_t lane, double omega, double beta, double h) {
+    DampedOscillatorStep step;
+    step.set(omega, beta, h);
+    _m00[lane] = step.m00;
+    _m01[lane] = step.m01;
+    _m10[lane] = step.m10;
+    _m11[lane] = step.m11;
+  }
+
+  void setGain(size_t lane, size_t c, double gx, double gv = 0) {
+    _gx[c][lane] = gx;
+    _gv[c][lane] = gv;
+  }
+
+  // Samples [begin, end) the lane sounds in; end may be infinite
+  void setInterval(size_t lane, double begin, double end) {
+    _begin[lane] = begin;
+    _end[lane] = end;
+  }
+
+  double begin(size_t lane) const { return _begin[lane]; }
+  double end(size_t lane) const { return _end[lane]; }
+
+  void move(size_t from, size_t to) {
+    _x[to] = _x[from];
+    _v[to] = _v[from];
+    _m00[to] = _m00[from];
+    _m01[to] = _m01[from];
+    _m10[to] = _m10[from];
+    _m11[to] = _m11[from];
+    _begin[to] = _begin[from];
+    _end[to] = _end[from];
+    for (size_t c = 0; c < _numChannels; c++) {
+      _gx[c][to] = _gx[c][from];
+      _gv[c][to] = _gv[c][from];
+    }
+  }
+
+  // Makes a lane silent padding again
+  void clear(size_t lane) {
+    _x[lane] = _v[lane] = 0;
+    _m00[lane] = _m11[lane] = 1;
+    _m01[lane] = _m10[lane] = 0;
+    _begin[lane] = _end[lane] = 0;
+    for (size_t c = 0; c < _numChannels; c++) {
+      _gx[c][lane] = _gv[c][lane] = 0;
+    }
+  }
+
+  // Steps lanes [0, numLanes) (rounded up to whole groups) through samples
+  // start .. start + n - 1, adding channel c of the mix to out[c][0 .. n-1].
+  // Does not allocate.
+  void render(size_t numLanes, size_t start, size_t n, double * const *out) {
+
+    for (size_t done = 0; done < n; ) {
+
+      size_t len = std::min(n - done, size_t(BLOCK));
+
+      std::fill(_mix.begin(), _mix.begin() + _numChannels * BLOCK * OSCBANK_LANES, 0.0);
+      for (size_t g = 0; g < numLanes; g += OSCBANK_LANES) {
+        renderGroup(g, double(start + done), len);
+      }
+
+      for (size_t c = 0; c < _numChannels; c++) {
+        for (size_t s = 0; s < len; s++) {
+          const double *acc = &_mix[(c * BLOCK + s) * OSCBANK_LANES];
+          double sum = 0;
+          for (size_t l = 0; l < OSCBANK_LANES; l++) {
+            sum += acc[l];
+          }
+          out[c][done + s] += sum;
+        }
+      }
+
+      done += len;
+    }
+  }
+
+private:
+
+  static const size_t BLOCK = 256;
+
+  // How a group's lanes are heard: with a gain on x at the one channel,
+  // or (in a second pass) with gains on x, or on x and x', at each channel
+  enum Mixing {MIX_ONE, MIX_X, MIX_XV};
+
+  // Steps lanes g .. g + OSCBANK_LANES - 1 through len samples from sample
+  // 'start', adding the output of lane l at sample s in channel c to
+  // _mix[(c * BLOCK + s) * OSCBANK_LANES + l]
+  void renderGroup(size_t g, double start, size_t len) {
+
+    // lanes that are on for the whole block don't need the masks
+    bool allOn = true;
+    for (size_t l = 0; l < OSCBANK_LANES; l++) {
+      allOn = allOn && _begin[g + l] <= start && _end[g + l] - start >= double(len);
+    }
+
+    if (_velocityGains) {
+      if (allOn) stepGroup<MIX_XV, false>(g, start, len);
+      else stepGroup<MIX_XV, true>(g, start, len);
+    } else if (_numChannels > 1) {
+      if (allOn) stepGroup<MIX_X, false>(g, start, len);
+      else stepGroup<MIX_X, true>(g, start, len);
+    } else {
+      if (allOn) stepGroup<MIX_ONE, false>(g, start, len);
+      else stepGroup<MIX_ONE, true>(g, start, len);
+    }
+  }
+
+  // The loops of renderGroup, specialized so that the one over the lanes
+  // has no branches left and can be vectorized. What they read is copied
+  // into locals first, which stores to the mix cannot alias.
+  template <Mixing Mix, bool Masked>
+  void stepGroup(size_t g, double start, size_t len) {
+
+    double x[OSCBANK_LANES], v[OSCBANK_LANES];
+    double m00[OSCBANK_LANES], m01[OSCBANK_LANES], m10[OSCBANK_LANES], m11[OSCBANK_LANES];
+    double lo[OSCBANK_LANES], hi[OSCBANK_LANES], gain[OSCBANK_LANES];
+
+    for (size_t l = 0; l < OSCBANK_LANES; l++) {
+      x[l] = _x[g + l];
+      v[l] = _v[g + l];
+      m00[l] = _m00[g + l];
+      m01[l] = _m01[g + l];
+      m10[l] = _m10[g + l];
+      m11[l] = _m11[g + l];
+      lo[l] = _begin[g + l] - start;
+      hi[l] = _end[g + l] - start;
+      gain[l] = _gx[0][g + l];
+    }
+
+    // MIX_ONE adds straight into the mix, the others keep x (and x') of
+    // every sample, zero where the lane is silent, for the second pass
+    double *mix = &_mix[0];
+    double *xs = Mix == MIX_ONE ? mix : &_history[0];
+    double *vs = &_history[BLOCK * OSCBANK_LANES];
+
+    for (size_t s = 0; s < len; s++) {
+      double t = double(s);
+      double *xo = xs + s * OSCBANK_LANES;
+      double *vo = vs + s * OSCBANK_LANES;
+      for (size_t l = 0; l < OSCBANK_LANES; l++) {
+        bool on = !Masked || (t >= lo[l] && t < hi[l]);
+        if (Mix == MIX_ONE) xo[l] += on ? gain[l] * x[l] : 0.0;
+        if (Mix != MIX_ONE) xo[l] = on ? x[l] : 0.0;
+        if (Mix == MIX_XV) vo[l] = on ? v[l] : 0.0;
+        double xn = m00[l] * x[l] + m01[l] * v[l];
+        double vn = m10[l] * x[l] + m11[l] * v[l];
+        x[l] = on ? xn : x[l];
+        v[l] = on ? vn : v[l];
+      }
+    }
+
+    for (size_t l = 0; l < OSCBANK_LANES; l++) {
+      _x[g + l] = x[l];
+      _v[g + l] = v[l];
+    }
+
+    if (Mix == MIX_ONE) return;
+
+    for (size_t c = 0; c < _numChannels; c++) {
+
+      double gx[OSCBANK_LANES], gv[OSCBANK_LANES];
+      for (size_t l = 0; l < OSCBANK_LANES; l++) {
+        gx[l] = _gx[c][g + l];
+        gv[l] = _gv[c][g + l];
+      }
+
+      double *acc = mix + c * BLOCK * OSCBANK_LANES;
+      for (size_t i = 0; i < len * OSCBANK_LANES; i += OSCBANK_LANES) {
+        for (size_t l = 0; l < OSCBANK_LANES; l++) {
+          double y = gx[l] * xs[i + l];
+          if (Mix == MIX_XV) y += gv[l] * vs[i + l];
+          acc[i + l] += y;
+        }
+      }
+    }
+  }
+
+  size_t _numChannels;
+  bool _velocityGains;
+
+  // the lanes
+  std::vector<double> _x, _v;
+  std::vector<double> _m00, _m01, _m10, _m11;
+  std::vector<double> _begin, _end;
+
+  // gains, per channel and lane
+  std::vector<std::vector<double> > _gx, _gv;
+
+  // per-lane accumulators of one block, per channel, summed over the lanes
+  // at its end
+  std::vector<double> _mix;
+
+  // x and x' of a group over one block, for renderGroup
+  std::vector<double> _history;
+};
+
+
+#endif
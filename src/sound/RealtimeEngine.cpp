@@ -0,0 +1,427 @@
+//
+//  RealtimeEngine.cpp
+//  aletler
+//
+
+#include "RealtimeEngine.h"
+
+#include <algorithm>
+#include <limits>
+#include <cassert>
+
+
+// Counters have one writer each, so a plain load and store will do
+static void bump(std::atomic<size_t> &counter) {
+  counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+// Lane of a voice that is not sounding
+static const size_t VOICE_SILENT = size_t(-1);
+
+// End of a voice that has not been stopped yet
+static const double VOICE_OPEN = std::numeric_limits<double>::infinity();
+
+
+RealtimeEngine::RealtimeEngine(const std::vector<Eigen::Vector3d> &ears,
+                               size_t blockSize, size_t maxVoices, size_t lookahead,
+                               double sampleRate)
+: _lanes(ears.size(), true), _numActive(0), _nextBubble(0), _simulated(0),
+  _ears(ears), _numChannels(ears.size()), _blockSize(blockSize),
+  _maxVoices(maxVoices), _lookahead(lookahead), _sampleRate(sampleRate),
+  // every voice can start or stop, and then retune, in each block in flight
+  _queue(2 * maxVoices * (lookahead + 2)),
+  _running(false), _produced(0), _position(0),
+  _epoch(std::chrono::steady_clock::now()),
+  _blocks(0), _xruns(0), _starved(0), _droppedUpdates(0), _droppedVoices(0),
+  _maxCallback(0), _latencySum(0), _maxLatency(0), _latencyCount(0) {
+
+  assert(_numChannels <= REALTIME_MAX_CHANNELS);
+
+  _lanes.grow(maxVoices);
+  _voiceOf.assign(_lanes.size(), VOICE_SILENT);
+  _laneOf.assign(maxVoices, VOICE_SILENT);
+  _omega.assign(maxVoices, 0.0);
+
+  // hand out voice 0 first
+  for (size_t v = maxVoices; v > 0; v--) {
+    _freeVoices.push_back(v - 1);
+  }
+  _live.reserve(maxVoices);
+}
+
+
+RealtimeEngine::~RealtimeEngine() {
+  stop();
+}
+
+
+void RealtimeEngine::start() {
+
+  if (running()) return;
+
+  std::sort(_bubbles.begin() + _nextBubble, _bubbles.end(), Bubble::sort_by_birth);
+
+  // fill the lookahead before the first callback can ask for it
+  while (_simulated < position() + _lookahead * _blockSize) {
+    simulateBlock();
+  }
+
+  _running.store(true, std::memory_order_release);
+  _producer = std::thread(&RealtimeEngine::produce, this);
+}
+
+
+void RealtimeEngine::stop() {
+  _running.store(false, std::memory_order_release);
+  if (_producer.joinable()) {
+    _producer.join();
+  }
+}
+
+
+bool RealtimeEngine::post(VoiceUpdate &update) {
+  update.posted = now();
+  if (_queue.push(update)) return true;
+  bump(_droppedUpdates);
+  return false;
+}
+
+
+RealtimeStats RealtimeEngine::stats() const {
+
+  RealtimeStats s;
+  s.blocks = _blocks.load(std::memory_order_relaxed);
+  s.xruns = _xruns.load(std::memory_order_relaxed);
+  s.starved = _starved.load(std::memory_order_relaxed);
+  s.droppedUpdates = _droppedUpdates.load(std::memory_order_relaxed);
+  s.droppedVoices = _droppedVoices.load(std::memory_order_relaxed);
+  s.maxCallback = _maxCallback.load(std::memory_order_relaxed);
+  s.maxLatency = _maxLatency.load(std::memory_order_relaxed);
+
+  size_t count = _latencyCount.load(std::memory_order_relaxed);
+  s.meanLatency = count > 0 ? _latencySum.load(std::memory_order_relaxed) / double(count) : 0;
+  return s;
+}
+
+
+// -- audio side --
+
+void RealtimeEngine::process(double * const *out, size_t n) {
+
+  assert(n <= _blockSize);
+
+  double started = now();
+  size_t blockStart = _position.load(std::memory_order_relaxed);
+  size_t blockEnd = blockStart + n;
+
+  for (size_t c = 0; c < _numChannels; c++) {
+    std::fill(out[c], out[c] + n, 0.0);
+  }
+
+  if (produced() < blockEnd) {
+    bump(_starved);
+  }
+
+  while (const VoiceUpdate *u = _queue.front()) {
+    if (u->sample >= blockEnd) break;
+    apply(*u, blockStart, started);
+    _queue.pop();
+  }
+
+  _lanes.render(_numActive, blockStart, n, out);
+
+  // drop the voices that stopped during this block
+  for (size_t a = 0; a < _numActive; ) {
+    if (_lanes.end(a) <= double(blockEnd)) {
+      removeVoice(_voiceOf[a]);
+    } else {
+      a++;
+    }
+  }
+
+  _position.store(blockEnd, std::memory_order_release);
+
+  double elapsed = now() - started;
+  if (elapsed * _sampleRate > double(n)) {
+    bump(_xruns);
+  }
+  if (elapsed > _maxCallback.load(std::memory_order_relaxed)) {
+    _maxCallback.store(elapsed, std::memory_order_relaxed);
+  }
+  bump(_blocks);
+}
+
+
+void RealtimeEngine::apply(const VoiceUpdate &u, size_t blockStart, double time) {
+
+  size_t voice = u.voice;
+  if (voice >= _maxVoices) return;
+
+  // late updates take effect at the start of the block
+  double sample = double(std::max(u.sample, blockStart));
+  size_t lane = _laneOf[voice];
+
+  switch (u.kind) {
+
+    case VoiceUpdate::START:
+      if (lane == VOICE_SILENT) {
+        lane = _numActive++;
+        _laneOf[voice] = lane;
+        _voiceOf[lane] = voice;
+      }
+      _lanes.x(lane) = 1;
+      _lanes.v(lane) = 0;
+      _lanes.setInterval(lane, sample, VOICE_OPEN);
+      break;
+
+    case VoiceUpdate::RETUNE:
+      if (lane == VOICE_SILENT) return;
+      // keep the amplitude sqrt(x^2 + (x' / omega)^2) where it was
+      if (_omega[voice] > 0 && u.omega > 0) {
+        _lanes.v(lane) *= u.omega / _omega[voice];
+      }
+      break;
+
+    case VoiceUpdate::STOP:
+      if (lane != VOICE_SILENT) {
+        _lanes.setInterval(lane, _lanes.begin(lane), std::max(sample, _lanes.begin(lane)));
+      }
+      return;
+  }
+
+  _omega[voice] = u.omega;
+  _lanes.setStep(lane, u.omega, u.beta, 1.0 / _sampleRate);
+  for (size_t c = 0; c < _numChannels; c++) {
+    _lanes.setGain(lane, c, u.gx[c], u.gv[c]);
+  }
+
+  double latency = time - u.posted;
+  _latencySum.store(_latencySum.load(std::memory_order_relaxed) + latency, std::memory_order_relaxed);
+  if (latency > _maxLatency.load(std::memory_order_relaxed)) {
+    _maxLatency.store(latency, std::memory_order_relaxed);
+  }
+  bump(_latencyCount);
+}
+
+
+// Fills the voice's lane with the last sounding one, like OscillatorBank
+void RealtimeEngine::removeVoice(size_t voice) {
+
+  size_t lane = _laneOf[voice];
+  size_t last = --_numActive;
+
+  if (lane != last) {
+    _lanes.move(last, lane);
+    _voiceOf[lane] = _voiceOf[last];
+    _laneOf[_voiceOf[lane]] = lane;
+  }
+  _lanes.clear(last);
+  _voiceOf[last] = VOICE_SILENT;
+  _laneOf[voice] = VOICE_SILENT;
+}
+
+
+// -- producer side --
+
+void RealtimeEngine::produce() {
+
+  std::chrono::duration<double> nap(0.25 * double(_blockSize) / _sampleRate);
+
+  while (running()) {
+    if (_simulated >= position() + _lookahead * _blockSize) {
+      std::this_thread::sleep_for(nap);
+      continue;
+    }
+    simulateBlock();
+  }
+}
+
+
+struct BySample {
+  bool operator()(const VoiceUpdate &a, const VoiceUpdate &b) const {
+    return a.sample < b.sample;
+  }
+};
+
+
+// Runs the bubbles through the next block and posts what changed: births
+// and deaths at the sample they happen, and every other bubble's new
+// frequency for the block after
+void RealtimeEngine::simulateBlock() {
+
+  size_t begin = _simulated, end = begin + _blockSize;
+  double dt = 1.0 / _sampleRate;
+
+  _pendingUpdates.clear();
+
+  while (_nextBubble < _bubbles.size()) {
+
+    Bubble *bubble = _bubbles[_nextBubble];
+    double birth = bubble->get_birthtime() * _sampleRate;
+    if (birth >= double(end)) break;
+    _nextBubble++;
+
+    // heard from its birth to S_BUBBLELIFE later, like Bubble::renderBlock
+    size_t first = std::max(begin, size_t(std::max(ceil(birth), 0.0)));
+    size_t last = size_t(std::max(floor((bubble->get_birthtime() + Bubble::S_BUBBLELIFE) * _sampleRate) + 1, 0.0));
+    if (first >= last) continue;
+
+    if (_freeVoices.empty()) {
+      bump(_droppedVoices);
+      continue;
+    }
+
+    LiveBubble live;
+    live.bubble = bubble;
+    live.voice = _freeVoices.back();
+    live.begin = first;
+    live.end = last;
+    _freeVoices.pop_back();
+    _live.push_back(live);
+
+    VoiceUpdate u(VoiceUpdate::START, live.voice, first);
+    voiceUpdate(u, bubble);
+    _pendingUpdates.push_back(u);
+  }
+
+  for (size_t i = 0; i < _live.size(); ) {
+
+    LiveBubble &live = _live[i];
+
+    // one timestep per sample it is alive for, until it reaches the surface
+    size_t s = std::max(begin, live.begin);
+    size_t until = std::min(end, live.end);
+    while (s < until && !live.bubble->finished()) {
+      live.bubble->timestep(dt);
+      s++;
+    }
+
+    if (live.bubble->finished() || live.end <= end) {
+      _pendingUpdates.push_back(VoiceUpdate(VoiceUpdate::STOP, live.voice, s));
+      _freeVoices.push_back(live.voice);
+      live = _live.back();
+      _live.pop_back();
+      continue;
+    }
+
+    VoiceUpdate u(VoiceUpdate::RETUNE, live.voice, end);
+    voiceUpdate(u, live.bubble);
+    _pendingUpdates.push_back(u);
+    i++;
+  }
+
+  // the audio side applies updates in the order they arrive
+  std::stable_sort(_pendingUpdates.begin(), _pendingUpdates.end(), BySample());
+  for (size_t i = 0; i < _pendingUpdates.size(); i++) {
+    post(_pendingUpdates[i]);
+  }
+
+  _simulated = end;
+  advance(end);
+}
+
+
+void RealtimeEngine::voiceUpdate(VoiceUpdate &u, Bubble *bubble) {
+
+  std::complex<double> h[REALTIME_MAX_CHANNELS];
+  for (size_t c = 0; c < _numChannels; c++) {
+    h[c] = bubble->transfer(_ears[c]);
+  }
+
+  u.omega = 2 * M_PI * bubble->frequency();
+  u.beta = 0;
+  u.gains(h, _numChannels);
+}
+
+
+// -- sinks --
+
+AudioSink::AudioSink(RealtimeEngine &engine, bool paced)
+: _engine(engine), _paced(paced), _stop(false), _late(0) {}
+
+
+AudioSink::~AudioSink() {
+  stop();
+}
+
+
+void AudioSink::start() {
+  stop();
+  _stop.store(false, std::memory_order_release);
+  _thread = std::thread(&AudioSink::loop, this, size_t(-1));
+}
+
+
+void AudioSink::stop() {
+  _stop.store(true, std::memory_order_release);
+  if (_thread.joinable()) {
+    _thread.join();
+  }
+}
+
+
+void AudioSink::run(size_t nsamples) {
+  _stop.store(false, std::memory_order_release);
+  loop(nsamples);
+}
+
+
+void AudioSink::loop(size_t nsamples) {
+
+  typedef std::chrono::steady_clock Clock;
+
+  size_t n = _engine.blockSize();
+  size_t nchannels = _engine.numChannels();
+
+  std::vector<double> buffer(nchannels * n);
+  std::vector<double *> channels(nchannels);
+  for (size_t c = 0; c < nchannels; c++) {
+    channels[c] = &buffer[c * n];
+  }
+
+  Clock::duration period = std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(double(n) / _engine.sampleRate()));
+  Clock::time_point deadline = Clock::now();
+
+  for (size_t done = 0; done < nsamples && !_stop.load(std::memory_order_acquire); done += n) {
+
+    if (_paced) {
+      deadline += period;
+    } else {
+      // wait for the producer instead of the clock
+      while (_engine.running() && _engine.produced() < _engine.position() + n
+             && !_stop.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+      }
+    }
+
+    _engine.process(&channels[0], n);
+    consume(&channels[0], n);
+
+    if (_paced) {
+      if (Clock::now() > deadline) {
+        _late.fetch_add(1, std::memory_order_relaxed);
+      }
+      std::this_thread::sleep_until(deadline);
+    }
+  }
+}
+
+
+FileSink::FileSink(RealtimeEngine &engine, const char *filename, bool paced,
+                   SFMSampleFormat format)
+: AudioSink(engine, paced),
+  _file(filename, int(engine.sampleRate()), int(engine.numChannels()), format) {
+  _file.open(WriteOnly);
+}
+
+
+FileSink::~FileSink() {
+  stop();
+  _file.close();
+}
+
+
+void FileSink::consume(const double * const *channels, size_t n) {
+  _file.writeBlock(channels, n);
+}
@@ -0,0 +1,290 @@
+//
+//  RealtimeEngine.h
+//  aletler
+//
+//  Real-time bubble synthesis. The work is split between two threads:
+//
+//  - a producer thread runs the bubble simulation (Bubble::timestep and the
+//    frequency updates) a few blocks ahead of what is being heard, and
+//    sends what changed as VoiceUpdates through a lock-free SpscQueue;
+//
+//  - the audio callback, process(), applies the updates that are due and
+//    synthesizes the next block from a fixed pool of voices, the sounding
+//    ones kept in the lanes of an OscillatorLanes (the engine of
+//    OscillatorBank too). It never allocates, locks or waits, so it can run
+//    on a device's audio thread.
+//
+//  A voice is heard at channel c as gx[c] x + gv[c] x', which with x = 1,
+//  x' = 0 at birth is Re(H_c e^{-i omega t}) for the complex amplitude H_c
+//  at that channel's ear (Monopole::transfer), like the offline renderer.
+//  Frequency changes keep the amplitude of the oscillator continuous.
+//
+//  An AudioSink stands in for the device: it calls process() one block at
+//  a time on its own thread, either paced by the clock or as fast as the
+//  producer allows. NullSink discards the audio and FileSink writes it to
+//  a file, so the engine can be run and measured without a sound card.
+//
+
+#ifndef aletler_RealtimeEngine_h
+#define aletler_RealtimeEngine_h
+
+#include <vector>
+#include <complex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+#include <Eigen/Dense>
+
+#include <numeric/SpscQueue.h>
+#include <physics/PhysicalConstants.h>
+
+#include "BubbleSound.h"
+#include "OscillatorLanes.h"
+#include "SoundFileManager.h"
+
+// Most output channels (ears) an engine can render
+#define REALTIME_MAX_CHANNELS 8
+
+
+// A change to one voice, from sample 'sample' on. Starts and stops take
+// effect at that exact sample, retunes at the start of the block it
+// falls in.
+struct VoiceUpdate {
+
+  enum Kind {START, RETUNE, STOP};
+
+  VoiceUpdate(Kind k = START, size_t v = 0, size_t s = 0, double w = 0, double b = 0)
+  : kind(k), voice(v), sample(s), omega(w), beta(b), posted(0) {
+    for (size_t c = 0; c < REALTIME_MAX_CHANNELS; c++) {
+      gx[c] = gv[c] = 0;
+    }
+  }
+
+  // Sets the channel gains so that channel c hears the real part of
+  // h[c] e^{-i omega t} (t from the start of the voice)
+  void gains(const std::complex<double> *h, size_t nchannels) {
+    for (size_t c = 0; c < nchannels; c++) {
+      gx[c] = h[c].real();
+      gv[c] = omega > 0 ? -h[c].imag() / omega : 0;
+    }
+  }
+
+  Kind kind;
+  size_t voice;
+  size_t sample;
+
+  // x'' + beta x' + omega^2 x = 0
+  double omega, beta;
+
+  // channel c hears gx[c] x + gv[c] x'
+  double gx[REALTIME_MAX_CHANNELS], gv[REALTIME_MAX_CHANNELS];
+
+  // when it was posted (seconds on the engine's clock), set by post
+  double posted;
+};
+
+
+struct RealtimeStats {
+
+  // calls to process
+  size_t blocks;
+
+  // calls that took longer than the audio they produced
+  size_t xruns;
+
+  // calls made before the producer had simulated that far
+  size_t starved;
+
+  // updates lost to a full queue, and bubbles not heard for lack of a voice
+  size_t droppedUpdates, droppedVoices;
+
+  // longest call to process (seconds)
+  double maxCallback;
+
+  // from posting an update to the start of the block that applies it
+  // (seconds): how far the producer is ahead of what is heard
+  double meanLatency, maxLatency;
+};
+
+
+class RealtimeEngine {
+
+public:
+
+  // Renders to one channel per ear, in blocks of blockSize samples, with up
+  // to maxVoices bubbles sounding at once. The producer thread stays
+  // lookahead blocks ahead of the audio.
+  RealtimeEngine(const std::vector<Eigen::Vector3d> &ears,
+                 size_t blockSize = 256, size_t maxVoices = 1024, size_t lookahead = 4,
+                 double sampleRate = PhysicalConstants::Sound::SAMPLING_RATE);
+
+  ~RealtimeEngine();
+
+  // Adds a bubble for the producer thread to simulate; only before start.
+  // The engine does not take ownership.
+  void addBubble(Bubble *bubble) { _bubbles.push_back(bubble); }
+
+  // Starts / stops the producer thread. start simulates the first
+  // lookahead blocks before it returns.
+  void start();
+  void stop();
+  bool running() const { return _running.load(std::memory_order_acquire); }
+
+  // The audio callback: writes the next n <= blockSize() samples of
+  // channel c to out[c]
+  void process(double * const *out, size_t n);
+
+  // Producer side, for driving the voices without the bubble thread (from
+  // one thread only, and not while it is running). post queues an update
+  // (returning false if the queue is full); advance tells the audio side
+  // that everything before sample 'until' has been posted.
+  bool post(VoiceUpdate &update);
+  void advance(size_t until) { _produced.store(until, std::memory_order_release); }
+
+  // Samples posted / heard so far
+  size_t produced() const { return _produced.load(std::memory_order_acquire); }
+  size_t position() const { return _position.load(std::memory_order_acquire); }
+
+  size_t numChannels() const { return _numChannels; }
+  size_t blockSize() const { return _blockSize; }
+  size_t maxVoices() const { return _maxVoices; }
+  double sampleRate() const { return _sampleRate; }
+
+  // Time (seconds) from a change in the simulation to hearing it: the
+  // producer's lookahead plus the block being played
+  double latency() const { return double((_lookahead + 1) * _blockSize) / _sampleRate; }
+
+  RealtimeStats stats() const;
+
+  // Seconds since the engine was made
+  double now() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - _epoch).count();
+  }
+
+private:
+
+  RealtimeEngine(const RealtimeEngine &);
+  RealtimeEngine &operator=(const RealtimeEngine &);
+
+  // -- audio side --
+
+  void apply(const VoiceUpdate &u, size_t blockStart, double time);
+  void removeVoice(size_t voice);
+
+  // lanes [0, _numActive) are sounding: lane a plays voice _voiceOf[a],
+  // and voice v is in lane _laneOf[v] (VOICE_SILENT if none)
+  OscillatorLanes _lanes;
+  std::vector<size_t> _voiceOf, _laneOf;
+  size_t _numActive;
+
+  // per voice, the frequency it was last tuned to
+  std::vector<double> _omega;
+
+  // -- producer side --
+
+  struct LiveBubble {
+    Bubble *bubble;
+    size_t voice, begin, end;
+  };
+
+  void produce();
+  void simulateBlock();
+  void voiceUpdate(VoiceUpdate &u, Bubble *bubble);
+
+  std::vector<Bubble *> _bubbles;
+  size_t _nextBubble;
+  std::vector<LiveBubble> _live;
+  std::vector<size_t> _freeVoices;
+  std::vector<VoiceUpdate> _pendingUpdates;
+  size_t _simulated;
+  std::thread _producer;
+
+  // -- shared --
+
+  std::vector<Eigen::Vector3d> _ears;
+  size_t _numChannels, _blockSize, _maxVoices, _lookahead;
+  double _sampleRate;
+
+  SpscQueue<VoiceUpdate> _queue;
+  std::atomic<bool> _running;
+  std::atomic<size_t> _produced, _position;
+  std::chrono::steady_clock::time_point _epoch;
+
+  // written by one thread each, read by stats
+  std::atomic<size_t> _blocks, _xruns, _starved, _droppedUpdates, _droppedVoices;
+  std::atomic<double> _maxCallback, _latencySum, _maxLatency;
+  std::atomic<size_t> _latencyCount;
+};
+
+
+// Stands in for an audio device: calls the engine's process() one block at a
+// time, on its own thread (start / stop) or on the caller's (run). Paced, it
+// asks for a block every blockSize / sampleRate seconds like a sound card;
+// otherwise it goes as fast as the producer lets it.
+class AudioSink {
+
+public:
+
+  AudioSink(RealtimeEngine &engine, bool paced = true);
+  virtual ~AudioSink();
+
+  void start();
+  void stop();
+
+  // Renders nsamples samples (rounded up to whole blocks) on this thread
+  void run(size_t nsamples);
+
+  // Blocks that were ready after their deadline (paced only)
+  size_t late() const { return _late.load(std::memory_order_relaxed); }
+
+protected:
+
+  // Receives each block rendered, on the rendering thread. Subclasses
+  // must call stop() in their destructor, so that the thread is gone
+  // before they are.
+  virtual void consume(const double * const *, size_t) {}
+
+private:
+
+  AudioSink(const AudioSink &);
+  AudioSink &operator=(const AudioSink &);
+
+  void loop(size_t nsamples);
+
+  RealtimeEngine &_engine;
+  bool _paced;
+  std::atomic<bool> _stop;
+  std::atomic<size_t> _late;
+  std::thread _thread;
+};
+
+
+// Discards the audio
+class NullSink : public AudioSink {
+public:
+  NullSink(RealtimeEngine &engine, bool paced = true) : AudioSink(engine, paced) {}
+  ~NullSink() { stop(); }
+};
+
+
+// Writes the audio to a sound file, one block at a time
+class FileSink : public AudioSink {
+
+public:
+
+  FileSink(RealtimeEngine &engine, const char *filename, bool paced = false,
+           SFMSampleFormat format = PCM16);
+  ~FileSink();
+
+protected:
+
+  void consume(const double * const *channels, size_t n);
+
+private:
+
+  SoundFileManager _file;
+};
+
+
+#endif
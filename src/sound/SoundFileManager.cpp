@@ -9,6 +9,7 @@
 #include "SoundFileManager.h"
 #include <iostream>
 #include <cstdlib>
+#include <algorithm>
 
 // libsndfile is the bomb: http://www.mega-nerd.com/libsndfile/api.html
 //#include <sndfile.h>
@@ -16,21 +17,35 @@
 
 using namespace std;
 
-SoundFileManager::SoundFileManager(const char *filename, int samplerate, int nchannels) {
+SoundFileManager::SoundFileManager(const char *filename, int samplerate, int nchannels,
+                                   SFMSampleFormat sampleformat) {
     
-  init_sfinfo(samplerate, nchannels);
+  init_sfinfo(samplerate, nchannels, sampleformat);
     
   m_filename = filename;
     
   m_sndfile = NULL;
+  m_openmode = ReadOnly;
+  
+  m_syncinterval = 0;
+  m_frameswritten = 0;
+  m_unsyncedframes = 0;
 }
 
 
 
 void SoundFileManager::open(SFMOpenMode openmode) {
+  m_openmode = openmode;
+  m_frameswritten = 0;
+  m_unsyncedframes = 0;
+  
   if (openmode == WriteOnly) {
         
     m_sndfile = sf_open(m_filename.c_str(), SFM_WRITE, &m_sfinfo);
+    
+    if (! m_sndfile) {
+      cout << "Could not open " << m_filename << " for writing: " << sf_strerror(NULL) << endl;
+    }
         
   } else {
         
@@ -46,17 +61,29 @@ void SoundFileManager::open(SFMOpenMode openmode) {
 }
 
 void SoundFileManager::close() {
+  if (! m_sndfile) return;
+  
+  if (m_openmode == WriteOnly && m_unsyncedframes > 0) {
+    sf_write_sync(m_sndfile);
+  }
   sf_close(m_sndfile);
+  m_sndfile = NULL;
 }
 
 
-void SoundFileManager::init_sfinfo(int samplerate, int nchannels) {
+void SoundFileManager::init_sfinfo(int samplerate, int nchannels, SFMSampleFormat sampleformat) {
     
   m_sfinfo.samplerate = samplerate;    
   m_sfinfo.channels = nchannels;
 
   // and this is standard:
-  m_sfinfo.format = SF_FORMAT_AIFF | SF_FORMAT_PCM_16;
+  m_sfinfo.format = SF_FORMAT_AIFF;
+  
+  switch (sampleformat) {
+    case PCM24:   m_sfinfo.format |= SF_FORMAT_PCM_24; break;
+    case Float32: m_sfinfo.format |= SF_FORMAT_FLOAT; break;
+    default:      m_sfinfo.format |= SF_FORMAT_PCM_16; break;
+  }
 
   if (! sf_format_check(& m_sfinfo)) {
         
@@ -68,30 +95,138 @@ void SoundFileManager::init_sfinfo(int samplerate, int nchannels) {
 
 
 void SoundFileManager::writeAudio(SoundTrack &st) {
-  const std::vector<double> *samples = st.get_single_track();
-  std::cout << "Writing # samples: " << samples->size() << std::endl;
-  sf_write_double(m_sndfile, &samples->at(0), samples->size());
-  sf_write_sync(m_sndfile);
-}
+  
+  // Goes through writeBlock a piece at a time, instead of making an
+  // interleaved copy of the whole track
+  static const size_t BLOCK_FRAMES = 16384;
+  
+  size_t nframes = st.numSamples();
+  std::cout << "Writing # samples: " << nframes * m_sfinfo.channels << std::endl;
+  
+  std::vector<const double *> channels(m_sfinfo.channels);
+  
+  for (size_t f = 0; f < nframes; f += BLOCK_FRAMES) {
+    size_t n = std::min(BLOCK_FRAMES, nframes - f);
     
+    for (int c = 0; c < m_sfinfo.channels; c++) {
+      // a mono track goes to every channel of the file
+      channels[c] = st.channelData(c < st.numChannels() ? c : 0) + f;
+    }
+    writeBlock(&channels[0], n);
+  }
+  
+  if (m_sndfile) {
+    sf_write_sync(m_sndfile);
+    m_unsyncedframes = 0;
+  }
+}
+
+
+void SoundFileManager::writeBlock(const double * const *channels, size_t nframes) {
+  
+  size_t nchannels = m_sfinfo.channels;
+  m_interleaved.resize(nframes * nchannels);
+  
+  for (size_t c = 0; c < nchannels; c++) {
+    const double *src = channels[c];
+    double *dst = &m_interleaved[c];
+    for (size_t i = 0; i < nframes; i++) {
+      dst[i * nchannels] = src[i];
+    }
+  }
+  
+  write_interleaved(nframes);
+}
+
+
+void SoundFileManager::writeMonoBlock(const double *samples, size_t nframes) {
+  
+  std::vector<const double *> channels(m_sfinfo.channels, samples);
+  writeBlock(&channels[0], nframes);
+}
+
+
+void SoundFileManager::write_interleaved(size_t nframes) {
+  
+  if (! m_sndfile || nframes == 0) return;
+  
+  sf_count_t written = sf_writef_double(m_sndfile, &m_interleaved[0], nframes);
+  if (written != sf_count_t(nframes)) {
+    cout << "Short write to " << m_filename << ": " << sf_strerror(m_sndfile) << endl;
+  }
+  
+  m_frameswritten += nframes;
+  m_unsyncedframes += nframes;
+  
+  if (m_syncinterval > 0 && m_unsyncedframes >= m_syncinterval) {
+    sf_write_sync(m_sndfile);
+    m_unsyncedframes = 0;
+  }
+}
+
+
 void SoundFileManager::readAudio(SoundTrack &st) {
-        
-  sf_count_t count;
-  double *ptr = new double[m_sfinfo.frames];
-        
+  
+  static const size_t BLOCK_FRAMES = 16384;
+  
+  if (! m_sndfile) return;
+  
   std::cout << "Num FRAMES: " << m_sfinfo.frames << std::endl;
-        
-  count = sf_read_double(m_sndfile, ptr, m_sfinfo.frames) ;
-        
+  
+  st.reserve(st.numSamples() + numFrames());
+  
+  int nchannels = m_sfinfo.channels;
+  size_t count = 0;
+  
+  if (nchannels == st.numChannels()) {
+    // same layout: let the track deinterleave straight from the read buffer
+    m_interleaved.resize(BLOCK_FRAMES * nchannels);
+    sf_count_t n;
+    while ((n = sf_readf_double(m_sndfile, &m_interleaved[0], BLOCK_FRAMES)) > 0) {
+      st.addInterleaved(&m_interleaved[0], size_t(n));
+      count += size_t(n);
+    }
+    
+    std::cout << "Num COUNT: " << count << std::endl;
+    return;
+  }
+  
+  std::vector<std::vector<double> > blocks(nchannels, std::vector<double>(BLOCK_FRAMES));
+  std::vector<double *> channels(nchannels);
+  for (int c = 0; c < nchannels; c++) {
+    channels[c] = &blocks[c][0];
+  }
+  
+  while (size_t n = readBlock(&channels[0], BLOCK_FRAMES)) {
+    for (int c = 0; c < st.numChannels(); c++) {
+      st.addSamples(channels[std::min(c, nchannels - 1)], n, c);
+    }
+    count += n;
+  }
+  
   std::cout << "Num COUNT: " << count << std::endl;
+}
 
-        
-  for (int i = 0; i < count; i++) {
-    st.addSample(ptr[i], 0);
+
+size_t SoundFileManager::readBlock(double * const *channels, size_t maxframes) {
+  
+  if (! m_sndfile || maxframes == 0) return 0;
+  
+  size_t nchannels = m_sfinfo.channels;
+  m_interleaved.resize(maxframes * nchannels);
+  
+  sf_count_t count = sf_readf_double(m_sndfile, &m_interleaved[0], maxframes);
+  if (count <= 0) return 0;
+  
+  size_t nframes = size_t(count);
+  
+  for (size_t c = 0; c < nchannels; c++) {
+    const double *src = &m_interleaved[c];
+    double *dst = channels[c];
+    for (size_t i = 0; i < nframes; i++) {
+      dst[i] = src[i * nchannels];
+    }
   }
-        
-        
-        
-  delete ptr;
+  
+  return nframes;
 }
-    
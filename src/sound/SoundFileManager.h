@@ -14,22 +14,70 @@
 // libsndfile is the bomb: http://www.mega-nerd.com/libsndfile/api.html
 #include <sndfile.h>
 #include <string>
+#include <vector>
 
 #include "SoundTrack.h"
 
 
 enum SFMOpenMode {ReadOnly, WriteOnly};
 
+// Sample encoding of the file written (AIFF container in all cases)
+enum SFMSampleFormat {PCM16, PCM24, Float32};
+
 class SoundFileManager {
     
  public:
-  SoundFileManager(const char *filename, int samplerate = 44100, int nchannels = 2);
+  SoundFileManager(const char *filename, int samplerate = 44100, int nchannels = 2,
+                   SFMSampleFormat sampleformat = PCM16);
     
   void open(SFMOpenMode openmode);
   void close();
+  
+  bool isOpen() const { return m_sndfile != NULL; }
     
   void writeAudio(SoundTrack &st);
+  
+  /**
+   * Appends the whole file to st. Channel c of st gets channel c of the
+   * file (or the file's last channel, e.g. a mono file into a stereo track).
+   */
   void readAudio(SoundTrack &st);    
+  
+  /**
+   * Streaming input: reads the next (up to) maxframes frames of a file
+   * opened ReadOnly, deinterleaved into channels[0 .. numChannels()-1],
+   * each with room for maxframes samples. Returns the number of frames
+   * read, which is 0 once the whole file has been read:
+   *
+   *   while (size_t n = sfm.readBlock(channels, 4096)) { ... }
+   */
+  size_t readBlock(double * const *channels, size_t maxframes);
+  
+  // Format of the file, valid once it is open
+  int numChannels() const { return m_sfinfo.channels; }
+  int sampleRate() const { return m_sfinfo.samplerate; }
+  size_t numFrames() const { return size_t(m_sfinfo.frames); }
+  
+  /**
+   * Streaming output: appends nframes frames to a file opened WriteOnly.
+   * channels[c] points to the nframes samples of channel c. The samples are
+   * interleaved into a buffer that is reused from one block to the next, so
+   * memory use only depends on the block size.
+   */
+  void writeBlock(const double * const *channels, size_t nframes);
+  
+  /**
+   * Same, with the same samples in every channel.
+   */
+  void writeMonoBlock(const double *samples, size_t nframes);
+  
+  /**
+   * Flushes the file to disk every nframes frames written by writeBlock
+   * (0, the default, only flushes on close).
+   */
+  void setSyncInterval(size_t nframes) { m_syncinterval = nframes; }
+  
+  size_t framesWritten() const { return m_frameswritten; }
     
     
  private:
@@ -37,13 +85,23 @@ class SoundFileManager {
     
   SF_INFO m_sfinfo;
   SNDFILE *m_sndfile;
+  SFMOpenMode m_openmode;
+  
+  // interleaved copy of the block being written or read
+  std::vector<double> m_interleaved;
+  
+  size_t m_syncinterval;
+  size_t m_frameswritten;
+  size_t m_unsyncedframes;
     
     
   /**
    * Initializes a sound file info struct with some
    * default options.
    */
-  void init_sfinfo(int samplerate, int nchannels);
+  void init_sfinfo(int samplerate, int nchannels, SFMSampleFormat sampleformat);
+  
+  void write_interleaved(size_t nframes);
 
     
 };
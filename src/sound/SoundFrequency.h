@@ -25,18 +25,17 @@ class SoundFrequency {
 public:
   
   void addFrequency(double t, double freq, FrequencyType ft = FREQ_HERTZ) {
-    _times.push_back(t);
     
     if (ft == FREQ_HERTZ) {
-      _frequencies.push_back(freq * 2 * M_PI);
+      _frequencies.addKey(t, freq * 2 * M_PI);
     } else {
-      _frequencies.push_back(freq);
+      _frequencies.addKey(t, freq);
     }
   }
   
-  double frequencyAt(double t, FrequencyType ft = FREQ_HERTZ) {
+  double frequencyAt(double t, FrequencyType ft = FREQ_HERTZ) const {
     
-    double freq = interpLinearVectors(t, _times, _frequencies);
+    double freq = _frequencies(t);
     
     if (ft == FREQ_HERTZ)
       return freq * 0.5 * M_1_PI;
@@ -44,16 +43,38 @@ public:
       return freq;    
   }
   
+  // Frequencies at t0, t0 + dt, ..., for a whole buffer of n samples
+  void frequenciesAt(double t0, double dt, double *freqs, size_t n,
+                     FrequencyType ft = FREQ_HERTZ) const {
+    
+    _frequencies.evaluateUniform(t0, dt, freqs, n);
+    
+    if (ft == FREQ_HERTZ) {
+      for (size_t i = 0; i < n; i++) {
+        freqs[i] *= 0.5 * M_1_PI;
+      }
+    }
+  }
+  
+  void setInterpolationMode(InterpolationMode mode) {
+    _frequencies.setMode(mode);
+  }
+  
+  InterpolationMode interpolationMode() const { return _frequencies.mode(); }
+  
   void printFrequencyVector() const {
-    for (size_t i = 0; i < _times.size(); i++) {
-      std::cout << "t " << _times[i] << "\tf " << _frequencies[i] << std::endl;
+    for (size_t i = 0; i < _frequencies.size(); i++) {
+      std::cout << "t " << times()[i] << "\tf " << omegas()[i] << std::endl;
     }
   }
   
-  double startTime() const { return _times[0]; }
-  double stopTime() const { return _times[_times.size() - 1]; }
+  double startTime() const { return times()[0]; }
+  double stopTime() const { return times()[times().size() - 1]; }
+  
+  bool isEmpty() const { return _frequencies.empty(); }
   
-  bool isEmpty() { return _times.size() == 0; }
+  const std::vector<double> &times() const { return _frequencies.keys(); }
+  const std::vector<double> &omegas() const { return _frequencies.values(); }
   
   void saveFrequencyFile(std::ofstream &ofile) const {
     //std::ofstream ofile;
@@ -62,18 +83,17 @@ public:
     for (size_t i = 0; i < _frequencies.size(); i++) {
       ofile << std::setprecision(10)
       << std::fixed
-      << _times[i] << " "
-      << _frequencies[i] << std::endl;
+      << times()[i] << " "
+      << omegas()[i] << std::endl;
     }
     
    // ofile.close();
   }
   
 private:
-  std::vector<double> _times;
   
   // stored here: the omegas (natural frequencies), not Hertz:
-  std::vector<double> _frequencies;
+  KeyframeInterpolator<double> _frequencies;
   
 };
 
@@ -7,10 +7,19 @@
 //
 
 #include "SoundTrack.h"
+#include "FilterChain.h"
 
 #include <vector>
 #include <algorithm>
 #include <cmath>
+#include <cstdlib>
+
+#include <Eigen/Core>
+
+
+static const size_t DOUBLES_PER_LINE = 64 / sizeof(double);
+
+typedef Eigen::Map<const Eigen::ArrayXd, Eigen::Aligned> AlignedConstMap;
 
 
 void scale_filter (const std::vector<double> &x, std::vector<double> &y, void *vsscalefactor) {
@@ -22,35 +31,126 @@ void scale_filter (const std::vector<double> &x, std::vector<double> &y, void *v
     }
 }
 
-SoundTrack::SoundTrack(int sr, int nchannels) : m_sr(sr), m_nchannels(nchannels) {
+SoundTrack::SoundTrack(int sr, int nchannels, size_t capacity) : m_sr(sr), m_nchannels(nchannels) {
     
-    m_single_track = NULL;
+    m_data = NULL;
+    m_capacity = 0;
+    m_sizes.resize(m_nchannels, 0);
     
     // Allocate memory for the array of audio channels
-    m_tracks = new std::vector<double>[m_nchannels];
-    
+    if (capacity > 0) {
+        grow(capacity);
+    }
 }
 
 
 SoundTrack::~SoundTrack() {
     
-    delete [] m_tracks;
-    if (m_single_track) delete m_single_track;
+    free(m_data);
 }
 
 
-void SoundTrack::normalize() {
-    double maxval = 0.0;
+void SoundTrack::grow(size_t n) {
+    
+    // whole cache lines per channel, and at least double the old size so
+    // that appending one sample at a time stays cheap
+    size_t capacity = std::max(n, 2 * m_capacity);
+    capacity = (capacity + DOUBLES_PER_LINE - 1) / DOUBLES_PER_LINE * DOUBLES_PER_LINE;
+    
+    void *block = NULL;
+    if (posix_memalign(&block, 64, capacity * m_nchannels * sizeof(double)) != 0) {
+        std::cout << "SoundTrack: out of memory for " << capacity << " samples per channel" << std::endl;
+        exit(-1);
+    }
+    double *data = (double *)block;
+    
+    for (int i = 0; i < m_nchannels; i++) {
+        std::copy(m_data + i * m_capacity, m_data + i * m_capacity + m_sizes[i], data + i * capacity);
+    }
+    
+    free(m_data);
+    m_data = data;
+    m_capacity = capacity;
+}
+
+
+void SoundTrack::resize(size_t n) {
+    
+    reserve(n);
     
-    // Find max value per track...
     for (int i = 0; i < m_nchannels; i++) {
-        for (int j = 0; j < m_tracks[i].size(); j++) {
-            
-            if (fabs(m_tracks[i][j]) > maxval) {
-                maxval = fabs(m_tracks[i][j]);
+        if (n > m_sizes[i]) {
+            std::fill(channelData(i) + m_sizes[i], channelData(i) + n, 0.0);
+        }
+        m_sizes[i] = n;
+    }
+}
+
+
+void SoundTrack::addSamples(const double *samps, size_t n, int chann) {
+    assert(chann < m_nchannels);
+    
+    if (m_sizes[chann] + n > m_capacity) {
+        grow(m_sizes[chann] + n);
+    }
+    std::copy(samps, samps + n, channelData(chann) + m_sizes[chann]);
+    m_sizes[chann] += n;
+}
+
+
+void SoundTrack::addInterleaved(const double *frames, size_t n) {
+    
+    verify_track_lengths();
+    
+    size_t first = numSamples();
+    reserve(first + n);
+    
+    if (m_nchannels == 2) {
+        double *left = channelData(0) + first;
+        double *right = channelData(1) + first;
+        for (size_t i = 0; i < n; i++) {
+            left[i] = frames[2 * i];
+            right[i] = frames[2 * i + 1];
+        }
+    } else {
+        for (int j = 0; j < m_nchannels; j++) {
+            double *dst = channelData(j) + first;
+            for (size_t i = 0; i < n; i++) {
+                dst[i] = frames[i * m_nchannels + j];
             }
         }
     }
+    
+    for (int j = 0; j < m_nchannels; j++) {
+        m_sizes[j] += n;
+    }
+}
+
+
+double SoundTrack::maxAbs() const {
+    double maxval = 0.0;
+    
+    // Find max value per track...
+    for (int i = 0; i < m_nchannels; i++) {
+        if (m_sizes[i] == 0) continue;
+        
+        AlignedConstMap track(channelData(i), m_sizes[i]);
+        maxval = std::max(maxval, track.abs().maxCoeff());
+    }
+    return maxval;
+}
+
+
+void SoundTrack::scale(double s) {
+    for (int i = 0; i < m_nchannels; i++) {
+        Gain gain(s);
+        processBlocks(gain, channelData(i), m_sizes[i]);
+    }
+}
+
+
+void SoundTrack::normalize() {
+    double maxval = maxAbs();
 
 
     // Prevent divide-by-zero errors:
@@ -61,47 +161,64 @@ void SoundTrack::normalize() {
     
     
     // Normalize!
-    applyFilter(&scale_filter, &inv_maxval, true);
+    scale(inv_maxval);
 }
 
 
 
 void SoundTrack::applyFilter(filterfn filter, void *args, bool inPlace) {
 
+    std::vector<double> track, newtrack;
+    
     for (int i = 0; i < m_nchannels; i++) {
         
+        track.assign(channelData(i), channelData(i) + m_sizes[i]);
+        
         if (inPlace) {
-            filter(m_tracks[i], m_tracks[i], args);
+            filter(track, track, args);
+            m_sizes[i] = 0;
+            addSamples(track.empty() ? NULL : &track[0], track.size(), i);
         }
         
         else {
-            std::vector<double> newtrack;
-            filter(m_tracks[i], newtrack, args);
+            newtrack.clear();
+            filter(track, newtrack, args);
         
-            m_tracks[i].resize(newtrack.size());
-            std::copy(newtrack.begin(), newtrack.end(), m_tracks[i].begin());
+            m_sizes[i] = 0;
+            addSamples(newtrack.empty() ? NULL : &newtrack[0], newtrack.size(), i);
         }
     }
 }
 
 
-
-std::vector<double> *SoundTrack::interleave() const {
-    
-    // Tracks haven't yet been interleaved? Let's do it.
-    
-    std::vector<double> *track = new std::vector<double>;
+void SoundTrack::applyFilter(blockfilterfn filter, void *args) {
     
+    for (int i = 0; i < m_nchannels; i++) {
+        filter(channelData(i), m_sizes[i], args);
+    }
+}
+
+
+
+void SoundTrack::interleave(double *out, size_t first, size_t n) const {
     
     // Assume all tracks contain same number of samples
     verify_track_lengths();
-    
-    
-    for (int i = 0; i < m_tracks[0].size(); i++) {
+    assert(first + n <= numSamples());
+    
+    if (m_nchannels == 2) {
+        const double *left = channelData(0) + first;
+        const double *right = channelData(1) + first;
+        for (size_t i = 0; i < n; i++) {
+            out[2 * i] = left[i];
+            out[2 * i + 1] = right[i];
+        }
+    } else {
         for (int j = 0; j < m_nchannels; j++) {
-            track->push_back(m_tracks[j][i]);
+            const double *src = channelData(j) + first;
+            for (size_t i = 0; i < n; i++) {
+                out[i * m_nchannels + j] = src[i];
+            }
         }
     }
-    
-    return track;
 }
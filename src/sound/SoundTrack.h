@@ -16,76 +16,129 @@
 
 typedef void (* filterfn) (const std::vector<double> &x, std::vector<double> &y, void *args);
 
+// Filters the n samples at x in place
+typedef void (* blockfilterfn) (double *x, size_t n, void *args);
 
+
+// Multichannel audio, stored planar: all the channels live in one 64-byte
+// aligned block, channel c starting at c * capacity(). The capacity is a
+// whole number of cache lines, so every channel is aligned too.
 class SoundTrack {
-    
+
 public:
-    SoundTrack(int sr = 44100, int nchannels = 2);
+    SoundTrack(int sr = 44100, int nchannels = 2, size_t capacity = 0);
     ~SoundTrack();
 
 
     void normalize();
-    
+
+    // Largest absolute sample over all channels
+    double maxAbs() const;
+
+    // Multiplies every sample by s
+    void scale(double s);
+
 
     void addSample(double samp, int chann) {
         assert(chann < m_nchannels);
-        m_tracks[chann].push_back(samp);
+        if (m_sizes[chann] == m_capacity) {
+            grow(m_capacity + 1);
+        }
+        channelData(chann)[m_sizes[chann]++] = samp;
     }
-    
-    
-    //const std::vector<double> &get_track() const { return m_track; }
-    
+
+    // Appends n samples to one channel
+    void addSamples(const double *samps, size_t n, int chann);
+
+    // Appends n interleaved frames (n * numChannels() samples)
+    void addInterleaved(const double *frames, size_t n);
+
+    // Makes room for n samples in every channel
+    void reserve(size_t n) {
+        if (n > m_capacity) {
+            grow(n);
+        }
+    }
+
+    size_t capacity() const { return m_capacity; }
+
+    // Sets every channel to n samples (new ones are zero)
+    void resize(size_t n);
+
+    void clear() { resize(0); }
+
+
     double sample(int sampnum, int chann) const {
-        return m_tracks[chann].at(sampnum);
+        assert(chann < m_nchannels && size_t(sampnum) < m_sizes[chann]);
+        return channelData(chann)[sampnum];
+    }
+
+    // The samples of one channel, contiguous and 64-byte aligned
+    double *channelData(int chann) {
+        assert(chann < m_nchannels);
+        return m_data + chann * m_capacity;
     }
-    
+    const double *channelData(int chann) const {
+        assert(chann < m_nchannels);
+        return m_data + chann * m_capacity;
+    }
+
+    size_t channelSize(int chann) const { return m_sizes[chann]; }
+
+    // Writes frames first .. first + n - 1 interleaved into out
+    // (n * numChannels() samples)
+    void interleave(double *out, size_t first, size_t n) const;
+
     std::vector<double> *get_single_track() {
-        
-        if (! m_single_track) {
-            m_single_track = interleave();
-        }
-        
-        assert(m_single_track);
-        assert(m_single_track->size() > 0);
-
-        for (int i = 0; i < m_single_track->size(); i++) {
-            if (m_single_track->at(i) != 0.0) {
-                std::cout << "Ok, they're not all zero. First nonzero value: " << m_single_track->at(i) << std::endl;
-                break;
-            }
+
+        m_single_track.resize(numSamples() * m_nchannels);
+        if (! m_single_track.empty()) {
+            interleave(&m_single_track[0], 0, numSamples());
         }
-        return m_single_track;
+        return &m_single_track;
     }
-    
-    size_t numSamples() const { return m_tracks[0].size(); }
-    
+
+    size_t numSamples() const { return m_sizes[0]; }
+
     int sampleRate() const {return m_sr;}
 
-    
+    int numChannels() const {return m_nchannels;}
+
+
+    // The filterfn interface works on std::vectors, so each channel is
+    // copied out and back; a blockfilterfn runs on the channel storage.
     void applyFilter(filterfn filter, void *args = NULL, bool inPlace = false);
-    
+    void applyFilter(blockfilterfn filter, void *args = NULL);
+
 private:
-    
+
+    // not copyable
+    SoundTrack(const SoundTrack &);
+    SoundTrack &operator=(const SoundTrack &);
+
     // We have to interleave the samples to have multiple channels
-    // This is computed the first time the single track is requested.
-    std::vector<double> *m_single_track;
-    
+    // This is recomputed each time the single track is requested.
+    std::vector<double> m_single_track;
+
     // Each channel has a separate track
     // This is where intermediate work is done (like filtering and
     // accumulation of samples)
-    std::vector<double> *m_tracks;
-    
+    double *m_data;
+    size_t m_capacity;
+    std::vector<size_t> m_sizes;
+
     int m_nchannels;
-    
+
     // Sample rate
     int m_sr;
-    
-    std::vector<double> *interleave() const;
-    
+
+    // Reallocates for at least n samples per channel (at least doubling)
+    void grow(size_t n);
+
     void verify_track_lengths() const {
-        size_t numSamples = m_tracks[0].size();
+        size_t numSamples = m_sizes[0];
         for (int i = 0; i < m_nchannels; i++) {
-            assert(m_tracks[i].size() == numSamples);
+            assert(m_sizes[i] == numSamples);
         }
     }
 };
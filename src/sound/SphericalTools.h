@@ -10,6 +10,9 @@
 
 #include <complex>
 #include <cmath>
+#include <vector>
+#include <algorithm>
+#include <cassert>
 
 using namespace std;
 
@@ -31,21 +34,20 @@ public:
         return -1;
     }
     
-    static int factorial(int n) {
-        if (n == 0) return 1;
-        
-        int fact = 1;
-        for (int i = 1; i <= n; i++) {
+    // n! as a double (exact up to 22!, finite up to 170!)
+    static double factorial(int n) {
+        double fact = 1;
+        for (int i = 2; i <= n; i++) {
             fact *= i;
         }
         
         return fact;
     }
     
-    static int double_factorial(int n) {
+    static double double_factorial(int n) {
         
         // initialize
-        int fact = 1;
+        double fact = 1;
         
         if (n == -1 || n == 0)
             return 1;
@@ -64,10 +66,110 @@ public:
         
     }
     
+    // log(n!), usable far past the point where n! overflows
+    static double log_factorial(int n) {
+        return lgamma(n + 1.0);
+    }
+    
     // http://stackoverflow.com/questions/3738384/stable-cotangent
     static double cot(double x) {return tan(M_PI_2 - x); }
     
-
+    
+    // Index of (m, n), -n <= m <= n, in the arrays of the batched functions
+    // below that go over all orders (size (N+1)^2)
+    static int index(int m, int n) { return n * n + n + m; }
+    
+    // Index of (m, n), 0 <= m <= n, in the triangular Legendre arrays
+    // (size (N+1)(N+2)/2)
+    static int tri_index(int m, int n) { return n * (n + 1) / 2 + m; }
+    
+    
+    // Spherical Bessel functions of the first kind j_0 .. j_N at x, by
+    // Miller's backward recurrence (forward recurrence loses all accuracy
+    // once n > |x|), normalized with j_0 or j_1.
+    static void j_all(int N, complex<double> x, complex<double> *out) {
+        
+        assert(N >= 0);
+        
+        if (abs(x) == 0) {
+            out[0] = 1;
+            for (int n = 1; n <= N; n++) out[n] = 0;
+            return;
+        }
+        
+        double ax = abs(x);
+        int nstart = int(std::max(double(N), ax)) + 16 + int(sqrt(40.0 * std::max(double(N), ax)));
+        
+        // f_{n-1} = (2n+1)/x f_n - f_{n+1}, from f_{nstart+1} = 0, f_nstart = tiny
+        complex<double> fnext = 0, f = 1e-300;
+        complex<double> f0 = 0, f1 = 0;
+        
+        for (int n = nstart; n >= 0; n--) {
+            
+            if (n <= N) out[n] = f;
+            if (n == 1) f1 = f;
+            if (n == 0) f0 = f;
+            
+            if (n > 0) {
+                complex<double> fprev = (2.0 * n + 1.0) / x * f - fnext;
+                fnext = f;
+                f = fprev;
+            }
+            
+            // keep the unnormalized values in range
+            if (abs(f) > 1e250) {
+                f *= 1e-250;
+                fnext *= 1e-250;
+                for (int k = std::max(n, 0); k <= N; k++) out[k] *= 1e-250;
+                if (n <= 1) f1 *= 1e-250;
+            }
+        }
+        
+        complex<double> scale;
+        if (abs(f0) >= abs(f1)) {
+            scale = (sin(x) / x) / f0;
+        } else {
+            scale = ((sin(x) / x - cos(x)) / x) / f1;
+        }
+        
+        for (int n = 0; n <= N; n++) {
+            out[n] *= scale;
+        }
+    }
+    
+    
+    // Spherical Bessel functions of the second kind y_0 .. y_N at x
+    // (forward recurrence (2.1.86), which is stable for them)
+    static void y_all(int N, complex<double> x, complex<double> *out) {
+        
+        assert(N >= 0);
+        
+        out[0] = -cos(x) / x;
+        if (N >= 1) out[1] = (-cos(x) / x - sin(x)) / x;
+        
+        for (int n = 2; n <= N; n++) {
+            out[n] = ((2.0*(n-1) + 1.0) / x) * out[n - 1] - out[n - 2];
+        }
+    }
+    
+    
+    // Spherical Hankel functions h_n = j_n + i y_n, n = 0 .. N, at x
+    static void h_all(int N, complex<double> x, complex<double> *out) {
+        
+        assert(N >= 0);
+        
+        // Base cases: formula (2.1.84) on pg 57
+        complex<double> h_0 = exp(ii*x) / (ii * x);
+        out[0] = h_0;
+        if (N >= 1) out[1] = h_0 * (1.0 / x - ii);
+        
+        // recurrence formula (2.1.86) on pg. 57 (h grows with n, so going
+        // forward is stable)
+        for (int n = 2; n <= N; n++) {
+            out[n] = ((2.0*(n-1) + 1) / x) * out[n - 1] - out[n - 2];
+        }
+    }
+    
     
     // Spherical Bessel function of the first kind
     // (inputs to regular spherical basis functions)
@@ -78,15 +180,9 @@ public:
             return double(neg_1_power(na)) * y(na - 1, x);
         }
         
-        if (n == 0) {
-            return sin(x) / x;
-        } else if (n == 1) {
-            return (sin(x) / pow(x, 2)) - (cos(x) / x);
-        } else if (n == 2) {
-            return (3.0/pow(x, 3) - 1.0/x) * sin(x) - (3.0/pow(x, 2)) * cos(x);
-        } else {
-            return j(n - 1, x) * (2.0 * (n - 1) + 1) / x - j(n - 2, x);
-        }
+        std::vector<complex<double> > js(n + 1);
+        j_all(n, x, &js[0]);
+        return js[n];
     }
     
     
@@ -97,16 +193,16 @@ public:
 
         assert(n >= 0);
         
-        if (n == 0) {
-            return -cos(x) /  x;
-        } else if (n == 1) {
-            return (-cos(x) / pow(x, 2)) - (sin(x) / x);
-        } else if (n == 2) {
-            return (-3.0/pow(x, 2) + 1.0) * (cos(x)/x) - (3.0*sin(x) / pow(x, 2));
-        } else {
-            // recurrence formula (2.1.86) on pg. 57
-            return ((2.0*(n-1) + 1.0) / x) * y(n - 1, x) - y(n - 2, x);
+        complex<double> prev = -cos(x) / x;
+        if (n == 0) return prev;
+        
+        complex<double> curr = (-cos(x) / x - sin(x)) / x;
+        for (int k = 2; k <= n; k++) {
+            complex<double> next = ((2.0*(k-1) + 1.0) / x) * curr - prev;
+            prev = curr;
+            curr = next;
         }
+        return curr;
     }
     
     
@@ -118,22 +214,76 @@ public:
         
         // for now, let's say m == (1):
         assert(m == 1);
+        assert(n >= 0);
         
-        complex<double> h_0 = exp(ii*x) / (ii * x);
+        complex<double> prev = exp(ii*x) / (ii * x);
+        if (n == 0) return prev;
         
-        // Base cases: formula (2.1.84) on pg 57
-        if (n == 0) {
-            return h_0;
-        } else if (n == 1) {
-            return -h_0 * (1.0 - (1.0 / (ii * x)));
-        } else if (n == 2) {
-            return (ii * h_0) * (1.0 - (3.0 / (ii*x)) + (3.0 / x));
-        } else {
+        complex<double> curr = prev * (1.0 / x - ii);
+        for (int k = 2; k <= n; k++) {
+            complex<double> next = ((2.0*(k-1) + 1) / x) * curr - prev;
+            prev = curr;
+            curr = next;
+        }
+        return curr;
+    }
+    
+    
+    // Associated Legendre functions normalized as in Y below,
+    //   sqrt((2n+1)/(4 pi) (n-m)!/(n+m)!) P_n^m(mu),
+    // for 0 <= m <= n <= N, into out[tri_index(m, n)]. The sectoral terms are
+    // computed through log-gamma, and the recurrences only involve ratios of
+    // order one, so nothing overflows even for large N.
+    static void P_normalized_all(int N, double mu, double *out) {
+        
+        assert(N >= 0);
+        
+        double s = sqrt(std::max(0.0, 1 - mu * mu));
+        double logs = log(s);
+        
+        for (int m = 0; m <= N; m++) {
+            
+            // P_m^m = (-1)^m (2m-1)!! s^m, and (2m-1)!! = (2m)! / (2^m m!)
+            double pmm;
+            if (m == 0) {
+                pmm = sqrt(0.25 * M_1_PI);
+            } else if (s == 0) {
+                pmm = 0;
+            } else {
+                double logpmm = 0.5 * log((2*m + 1) * 0.25 * M_1_PI)
+                                + 0.5 * log_factorial(2*m) - m * M_LN2 - log_factorial(m)
+                                + m * logs;
+                pmm = neg_1_power(m) * exp(logpmm);
+            }
+            out[tri_index(m, m)] = pmm;
             
-            // recurrence formula (2.1.86) on pg. 57
-            return ((2.0*(n-1) + 1) / x) * h(m, n - 1, x) - h(m, n - 2, x);
+            if (m == N) break;
+            
+            double pm1 = mu * sqrt(2.0*m + 3) * pmm;
+            out[tri_index(m, m + 1)] = pm1;
+            
+            for (int n = m + 2; n <= N; n++) {
+                double a = sqrt((4.0*n*n - 1) / (double(n*n) - double(m*m)));
+                double b = sqrt((double((n-1)*(n-1)) - double(m*m)) / (4.0*(n-1)*(n-1) - 1));
+                out[tri_index(m, n)] = a * (mu * out[tri_index(m, n - 1)] - b * out[tri_index(m, n - 2)]);
+            }
         }
+    }
+    
+    
+    // Associated Legendre functions P_n^m(mu) for 0 <= m <= n <= N, into
+    // out[tri_index(m, n)]
+    static void P_all(int N, double mu, double *out) {
         
+        P_normalized_all(N, mu, out);
+        
+        for (int n = 0; n <= N; n++) {
+            for (int m = 0; m <= n; m++) {
+                double lognorm = 0.5 * (log((2*n + 1) * 0.25 * M_1_PI)
+                                        + log_factorial(n - m) - log_factorial(n + m));
+                out[tri_index(m, n)] *= exp(-lognorm);
+            }
+        }
     }
     
     
@@ -146,30 +296,18 @@ public:
         assert(m <= n);
         //if (m > n) return 0;
         
-        // base case
-        if (n == 0) return 1;
+        // Recurrence relations (Volker Schonefeld, pg 5), going up in n
+        // from P_m^m
+        double prev = neg_1_power(m) * double_factorial(2*m - 1) * pow(1 - pow(mu, 2), m*0.5);
+        if (n == m) return prev;
         
-        // Special cases (Gumerov & Duraiswami, pg 47)
-        if (m == 1 && n == 1)
-            return -sqrt(1 - pow(mu, 2));
-        else if (m == 1 && n == 2)
-            return -3 * mu * sqrt(1 - pow(mu, 2));
-        else if (m == 2 && n == 2)
-            return 3 * (1 - pow(mu, 2));
-        
-        // Recurrence relations (Volker Schonefeld, pg 5)
-        if (m == n) {
-            return neg_1_power(n) * double_factorial(2*n - 1) * pow(1 - pow(mu, 2), n*0.5);
-            
-        } else if (n == m + 1) {
-            return mu * double(2*m + 1) * P(m, m, mu);
-
-        } else {
-            complex<double> left_recursion = P(m, n - 1, mu);
-            complex<double> right_recursion = P(m, n - 2, mu);
-            
-            return (mu * double(2*n - 1) * left_recursion - double(n + m - 1) * right_recursion) / double(n - m);
+        double curr = mu * double(2*m + 1) * prev;
+        for (int k = m + 2; k <= n; k++) {
+            double next = (mu * double(2*k - 1) * curr - double(k + m - 1) * prev) / double(k - m);
+            prev = curr;
+            curr = next;
         }
+        return curr;
     }
     
     
@@ -180,32 +318,96 @@ public:
         assert(n >= 0);
         assert(m >= -n && m <= n);
         
-        double root = sqrt( (2*n + 1) * factorial(n - abs(m)) / (4 * M_PI * factorial(n + abs(m)) ));
+        double lognorm = 0.5 * (log((2*n + 1) * 0.25 * M_1_PI)
+                                + log_factorial(n - abs(m)) - log_factorial(n + abs(m)));
 
-        return neg_1_power(m) * root * P(abs(m), n, cos(theta)) * exp(ii * double(m) * phi);
+        return neg_1_power(m) * exp(lognorm) * P(abs(m), n, cos(theta)) * exp(ii * double(m) * phi);
+    }
+    
+    
+    // All Y_n^m for n = 0 .. N, into out[index(m, n)]
+    static void Y_all(int N, double theta, double phi, complex<double> *out) {
+        
+        std::vector<double> p((N + 1) * (N + 2) / 2);
+        P_normalized_all(N, cos(theta), &p[0]);
+        
+        // e^{i m phi} by repeated multiplication
+        std::vector<complex<double> > eimphi(N + 1);
+        complex<double> eiphi = exp(ii * phi);
+        eimphi[0] = 1;
+        for (int m = 1; m <= N; m++) eimphi[m] = eimphi[m - 1] * eiphi;
+        
+        for (int n = 0; n <= N; n++) {
+            for (int m = 0; m <= n; m++) {
+                double pnm = neg_1_power(m) * p[tri_index(m, n)];
+                out[index(m, n)] = pnm * eimphi[m];
+                
+                // Y_n^{-m} = conj(Y_n^m) for this normalization
+                out[index(-m, n)] = pnm * conj(eimphi[m]);
+            }
+        }
+    }
+    
+    
+    static void spherical_coords(const Vector3d &rvec, double &r, double &theta, double &phi) {
+        r = rvec.norm();
+        theta = (r > 0) ? acos(rvec[2] / r) : 0;
+        phi = atan2(rvec[1], rvec[0]);
     }
     
     
     // Spherical basis functions
     static complex<double> R(int m, int n, complex<double> k, Vector3d rvec) {
         
-        double r = rvec.norm();
-        double theta = acos(rvec[2] / r);
-        double phi = cot(rvec[1]/rvec[0]);
+        double r, theta, phi;
+        spherical_coords(rvec, r, theta, phi);
         
         return j(n, k * r) * Y(m, n, theta, phi);
     }
     
     static complex<double> S(int m, int n, complex<double> k, Vector3d rvec) {
         
-        double r = rvec.norm();
-        double theta = acos(rvec[2] / r);
-        double phi = cot(rvec[1]/rvec[0]);
+        double r, theta, phi;
+        spherical_coords(rvec, r, theta, phi);
         
         return h(1, n, k * r) * Y(m, n, theta, phi);
     }
     
     
+    // All R_n^m (resp. S_n^m) for n = 0 .. N, into out[index(m, n)]
+    static void R_all(int N, complex<double> k, const Vector3d &rvec, complex<double> *out) {
+        
+        double r, theta, phi;
+        spherical_coords(rvec, r, theta, phi);
+        
+        std::vector<complex<double> > radial(N + 1);
+        j_all(N, k * r, &radial[0]);
+        Y_all(N, theta, phi, out);
+        
+        for (int n = 0; n <= N; n++) {
+            for (int m = -n; m <= n; m++) {
+                out[index(m, n)] *= radial[n];
+            }
+        }
+    }
+    
+    static void S_all(int N, complex<double> k, const Vector3d &rvec, complex<double> *out) {
+        
+        double r, theta, phi;
+        spherical_coords(rvec, r, theta, phi);
+        
+        std::vector<complex<double> > radial(N + 1);
+        h_all(N, k * r, &radial[0]);
+        Y_all(N, theta, phi, out);
+        
+        for (int n = 0; n <= N; n++) {
+            for (int m = -n; m <= n; m++) {
+                out[index(m, n)] *= radial[n];
+            }
+        }
+    }
+    
+    
     static complex<double> Greens(complex<double> k, Vector3d rvec) {
         return M_1_PI * 0.25 * exp(ii * k * rvec.norm()) / rvec.norm();
     }
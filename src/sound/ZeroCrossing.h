@@ -10,73 +10,89 @@
 #define soundmath_ZeroCrossing_h
 
 #include <fstream>
+#include <vector>
+#include <cassert>
 
+#include "SoundTrack.h"
+
+// Instantaneous frequency from the spacing of downward zero crossings (in
+// channel 0). Works either on a whole SoundTrack (analyze) or on a stream of
+// blocks (process), e.g. straight from SoundFileManager::readBlock, so that
+// long recordings don't have to be loaded at once.
 class ZeroCrossing {
 
 public:
-    ZeroCrossing(const SoundTrack *st) : m_soundtrack(st) {
+    ZeroCrossing(const SoundTrack *st) : m_soundtrack(st), m_samplerate(st->sampleRate()) {
+        reset();
+    }
+    
+    ZeroCrossing(int samplerate) : m_soundtrack(NULL), m_samplerate(samplerate) {
+        reset();
     }
     
     void analyze() {
-        size_t nsamp = m_soundtrack->numSamples();
-        
-        int last_zerox = 0;
-        
-        // j is used to look ahead to the next zero crossing
-        int i = 0, j = 1;
+        assert(m_soundtrack);
+        reset();
+        if (m_soundtrack->numSamples() > 0) {
+            process(m_soundtrack->channelData(0), m_soundtrack->numSamples());
+        }
+    }
+    
+    // Continues the analysis with the next n samples. Each sample between
+    // two crossings gets the frequency measured from those crossings
+    // (the ones before the second crossing get nothing).
+    void process(const double *samples, size_t n) {
         
-        while (i < nsamp) {
-            
-            //std::cout << "i:" << i << "   j:" << j << std::endl;
-            
-            // Look ahead
-            
-            // Get through all the negative zones
-            while ((j < nsamp) && m_soundtrack->sample(j, 0) < 0) {
-                j++;
-            }
-            
-            // Now get through the entire positive zone:
-            while (j < nsamp && m_soundtrack->sample(j, 0) >= 0) {
-                j++;
-            }
+        for (size_t k = 0; k < n; k++, m_pos++) {
             
-            // reached the end? get out
-            if (j >= nsamp)
-                return;
+            double x = samples[k];
             
-            // Now, there should be a zero crossing from j-1 (+) to j (-) :
-            assert(m_soundtrack->sample(j-1, 0) >= 0 && m_soundtrack->sample(j, 0) < 0);
-            
-            // Let's interp to get the exact zero crossing position:
-          
-            double slope = m_soundtrack->sample(j, 0) - m_soundtrack->sample(j-1, 0);
-            double diff = -m_soundtrack->sample(j-1, 0) / slope;
-            double next_zerox = (j-1) + diff;
-            
-            
-            // avoid divide-by-zero:
-            assert(next_zerox != last_zerox);
-            
-            double inst_freq = m_soundtrack->sampleRate() / (next_zerox - last_zerox);
-            //std::cout << "inst freq: " << inst_freq  << std::endl;
-            
-            while (i < j) {
+            // there is a zero crossing from m_pos-1 (+) to m_pos (-)
+            if (m_pos >= 2 && m_prev >= 0 && x < 0) {
+                
+                // Let's interp to get the exact zero crossing position:
+                double slope = x - m_prev;
+                double diff = -m_prev / slope;
+                double next_zerox = (m_pos - 1) + diff;
                 
-                // to avoid the erroneous spike in the beginning, we ignore
-                // the first reading:
-                if (last_zerox != 0) {
-                    m_freqs.push_back(inst_freq);
+                if (m_havezerox) {
+                    // avoid divide-by-zero:
+                    assert(next_zerox != m_lastzerox);
+                    
+                    double inst_freq = m_samplerate / (next_zerox - m_lastzerox);
+                    m_freqs.insert(m_freqs.end(), m_pos - m_firstunassigned, inst_freq);
                 }
-                i++;
+                
+                // to avoid the erroneous spike in the beginning, the samples
+                // before the first crossing get no reading
+                m_firstunassigned = m_pos;
+                m_lastzerox = next_zerox;
+                m_havezerox = true;
             }
-            j++;
-            last_zerox = next_zerox;
-            
             
+            m_prev = x;
         }
     }
     
+    void reset() {
+        m_freqs.clear();
+        m_pos = 0;
+        m_prev = 0;
+        m_firstunassigned = 0;
+        m_lastzerox = 0;
+        m_havezerox = false;
+    }
+    
+    // The frequencies found so far
+    const std::vector<double> &frequencies() const { return m_freqs; }
+    
+    // Moves the frequencies found so far into freqs, so that a streaming
+    // caller can keep memory bounded
+    void takeFrequencies(std::vector<double> &freqs) {
+        freqs.clear();
+        freqs.swap(m_freqs);
+    }
+    
     
     void outputToText() {
         std::ofstream freqdata;
@@ -90,8 +106,17 @@ public:
     
 private:
     const SoundTrack *m_soundtrack;
+    int m_samplerate;
     std::vector<double> m_freqs;
     
+    // streaming state: index and value of the last sample seen, first sample
+    // without a frequency yet, and the last crossing position
+    size_t m_pos;
+    double m_prev;
+    size_t m_firstunassigned;
+    double m_lastzerox;
+    bool m_havezerox;
+    
 };
 
 #endif
@@ -19,6 +19,13 @@
 #include <sound/util.h>
 #include <sound/ZeroCrossing.h>
 #include <sound/BoundaryPressure.h>
+#include <sound/OscillatorBank.h>
+#include <sound/Multipole.h>
+#include <sound/DopplerRenderer.h>
+#include <sound/RealtimeEngine.h>
+#include <sound/FilterChain.h>
+#include <sound/Convolver.h>
+#include <numeric/TimelineIndex.h>
 
 void filter_simplest_lowpass(const vector<double> &x, vector<double> &y, void *args) {
     for (int i = 1; i < x.size(); i++) {
@@ -54,6 +61,423 @@ void test_sphericalbasis() {
     }
 }
 
+// The batched basis functions should match the one-at-a-time ones, and
+// together satisfy the addition theorem (2.2.3) on pg 71 of
+// Gumerov/Duraiswami for |ear| < |source|
+void test_sphericalbatch() {
+    
+    const int N = 20;
+    std::vector<complex<double> > s(N * N), r(N * N);
+    
+    for (int i = 0; i < 100; i++) {
+        
+        double k = random_double(1, 20);
+        Vector3d source(random_double(-1, 1), random_double(-1, 1), random_double(-1, 1));
+        Vector3d ear = random_double(0, 0.3) * source.norm() * Vector3d::Random().normalized();
+        
+        SphericalTools::S_all(N - 1, k, source, &s[0]);
+        SphericalTools::R_all(N - 1, k, ear, &r[0]);
+        
+        complex<double> sum = 0;
+        for (int n = 0; n < N; n++) {
+            for (int m = -n; m <= n; m++) {
+                int idx = SphericalTools::index(m, n);
+                if (n < 6) {
+                    assert(abs(s[idx] - SphericalTools::S(m, n, k, source)) < 1e-8 * abs(s[idx]) + 1e-12);
+                    assert(abs(r[idx] - SphericalTools::R(m, n, k, ear)) < 1e-8 * abs(r[idx]) + 1e-12);
+                }
+                sum += s[SphericalTools::index(-m, n)] * r[idx];
+            }
+        }
+        
+        complex<double> g = SphericalTools::Greens(k, source - ear);
+        assert(abs(ii * k * sum - g) < 1e-6 * abs(g));
+    }
+}
+
+// The multipole tree should agree with summing every source at every
+// listener, and give the same answer on any number of threads
+void test_multipole() {
+    
+    const double k = 5;
+    std::vector<Vector3d> sources(3000), listeners(300);
+    std::vector<complex<double> > strengths(sources.size());
+    
+    for (size_t i = 0; i < sources.size(); i++) {
+        sources[i] = Vector3d(random_double(0, 1), random_double(0, 1), random_double(0, 1));
+        strengths[i] = complex<double>(random_double(-1, 1), random_double(-1, 1));
+    }
+    for (size_t j = 0; j < listeners.size(); j++) {
+        listeners[j] = Vector3d(random_double(-0.5, 1.5), random_double(-0.5, 1.5), random_double(0, 1));
+    }
+    
+    MultipoleTree tree(k, sources, listeners, 16);
+    assert(tree.topLevel() <= tree.depth());
+    
+    std::vector<complex<double> > fast, threaded, direct;
+    tree.evaluate(strengths, fast, 1);
+    tree.evaluate(strengths, threaded, 4);
+    tree.evaluateDirect(strengths, direct);
+    
+    double err = 0, norm = 0;
+    for (size_t j = 0; j < listeners.size(); j++) {
+        assert(fast[j] == threaded[j]);
+        err += std::norm(fast[j] - direct[j]);
+        norm += std::norm(direct[j]);
+    }
+    assert(sqrt(err / norm) < 1e-3);
+}
+
+// Rendering a monopole a block at a time should match evaluating it at
+// every sample, for a still and for a moving source
+void test_monopoleblock() {
+    
+    const size_t blocksize = 256, nblocks = 100;
+    const double dt = 1.0 / SAMPLING_RATE;
+    
+    std::vector<Vector3d> ears;
+    ears.push_back(Vector3d(1, 0, 0));
+    ears.push_back(Vector3d(1, HEAD_WIDTH, 0));
+    
+    for (int moving = 0; moving < 2; moving++) {
+        
+        Monopole blocks(800), samples(800);
+        if (moving) {
+            blocks.velocity(Vector3d(0, 14, 3));
+            samples.velocity(Vector3d(0, 14, 3));
+        }
+        
+        std::vector<double> left(blocksize * nblocks, 0.0), right(blocksize * nblocks, 0.0);
+        for (size_t b = 0; b < nblocks; b++) {
+            double *out[2] = {&left[b * blocksize], &right[b * blocksize]};
+            blocks.renderBlock(b * blocksize * dt, dt, blocksize, ears, out);
+        }
+        
+        double err = 0, peak = 0;
+        for (size_t i = 0; i < left.size(); i++) {
+            double l = samples.pressure(i * dt, ears[0]);
+            double r = samples.pressure(i * dt, ears[1]);
+            err = std::max(err, std::max(fabs(l - left[i]), fabs(r - right[i])));
+            peak = std::max(peak, std::max(fabs(l), fabs(r)));
+            samples.step(dt);
+        }
+        
+        assert(err < (moving ? 1e-2 : 1e-9) * peak);
+    }
+}
+
+// A source still at 1 m is heard 1 m / c later at 1 / (4 pi); one
+// approaching at v is heard at f / (1 - v / c)
+void test_doppler() {
+    
+    const size_t blocksize = 256, nblocks = 400;
+    const double f = 1000, v = 10;
+    
+    for (int moving = 0; moving < 2; moving++) {
+        
+        DopplerRenderer renderer(SAMPLING_RATE, 0.5, blocksize);
+        renderer.addListener(Vector3d(0, 0, 0));
+        renderer.addSource(Vector3d(moving ? 50 : 1, 0, 0));
+        
+        std::vector<double> emitted(blocksize), heard(blocksize * nblocks, 0.0);
+        for (size_t b = 0; b < nblocks; b++) {
+            for (size_t i = 0; i < blocksize; i++) {
+                emitted[i] = sin(2 * M_PI * f * double(b * blocksize + i) / SAMPLING_RATE);
+            }
+            double t = double((b + 1) * blocksize) / SAMPLING_RATE;
+            if (moving) {
+                renderer.moveSource(0, Vector3d(50 - v * t, 0, 0));
+            }
+            const double *in[1] = {&emitted[0]};
+            double *out[1] = {&heard[b * blocksize]};
+            renderer.process(in, out, blocksize);
+        }
+        
+        if (!moving) {
+            double delay = SAMPLING_RATE / C_AIR;
+            double err = 0;
+            for (size_t i = size_t(delay) + 4; i < heard.size(); i++) {
+                double expected = 0.25 * M_1_PI * sin(2 * M_PI * f * (i - delay) / SAMPLING_RATE);
+                err = std::max(err, fabs(heard[i] - expected));
+            }
+            assert(err < 1e-3 * 0.25 * M_1_PI);
+        } else {
+            // rising zero crossings after the first sound arrives
+            size_t first = 0, last = 0, count = 0;
+            for (size_t i = 8000; i + 1 < heard.size(); i++) {
+                if (heard[i] <= 0 && heard[i + 1] > 0) {
+                    if (count == 0) first = i;
+                    last = i;
+                    count++;
+                }
+            }
+            double observed = (count - 1) * SAMPLING_RATE / double(last - first);
+            assert(fabs(observed - f / (1 - v / C_AIR)) < 0.5);
+        }
+    }
+}
+
+// A voice started by hand should sound like the monopole it was set up
+// from until it is stopped; and the bubble thread should keep ahead of an
+// unpaced sink without losing anything
+void test_realtime() {
+    
+    std::vector<Vector3d> ears;
+    ears.push_back(Vector3d(1, 0, 0));
+    ears.push_back(Vector3d(1, HEAD_WIDTH, 0));
+    
+    {
+        RealtimeEngine engine(ears, 256, 4);
+        Monopole monopole(800);
+        
+        std::complex<double> h[2] = {monopole.transfer(ears[0]), monopole.transfer(ears[1])};
+        VoiceUpdate start(VoiceUpdate::START, 0, 100, 2 * M_PI * 800);
+        start.gains(h, 2);
+        VoiceUpdate stop(VoiceUpdate::STOP, 0, 3000);
+        engine.post(start);
+        engine.post(stop);
+        engine.advance(size_t(-1));
+        
+        std::vector<double> left(256), right(256);
+        double *out[2] = {&left[0], &right[0]};
+        
+        double err = 0, peak = 0;
+        for (size_t b = 0; b < 16; b++) {
+            engine.process(out, 256);
+            for (size_t i = 0; i < 256; i++) {
+                size_t s = b * 256 + i;
+                double t = (double(s) - 100) / SAMPLING_RATE;
+                double l = s >= 100 && s < 3000 ? monopole.pressure(t, ears[0]) : 0;
+                double r = s >= 100 && s < 3000 ? monopole.pressure(t, ears[1]) : 0;
+                err = std::max(err, std::max(fabs(l - left[i]), fabs(r - right[i])));
+                peak = std::max(peak, fabs(l));
+            }
+        }
+        assert(err < 1e-9 * peak);
+        assert(engine.stats().blocks == 16 && engine.stats().starved == 0);
+    }
+    
+    // voices that come and go move between lanes, which should not be heard
+    {
+        RealtimeEngine engine(ears, 256, 32);
+        std::vector<Monopole> monopoles;
+        std::vector<size_t> begins, ends;
+        std::vector<VoiceUpdate> updates;
+        for (size_t v = 0; v < 20; v++) {
+            double freq = random_double(300, 3000);
+            monopoles.push_back(Monopole(freq));
+            begins.push_back(rand() % 3000);
+            ends.push_back(begins.back() + 1 + rand() % 1000);
+            
+            std::complex<double> h[2] = {monopoles[v].transfer(ears[0]), monopoles[v].transfer(ears[1])};
+            VoiceUpdate start(VoiceUpdate::START, v, begins[v], 2 * M_PI * freq);
+            start.gains(h, 2);
+            updates.push_back(start);
+            updates.push_back(VoiceUpdate(VoiceUpdate::STOP, v, ends[v]));
+        }
+        
+        // the queue is read in order
+        for (size_t s = 0; s < 4096; s++) {
+            for (size_t u = 0; u < updates.size(); u++) {
+                if (updates[u].sample == s) engine.post(updates[u]);
+            }
+        }
+        engine.advance(size_t(-1));
+        
+        std::vector<double> left(256), right(256);
+        double *out[2] = {&left[0], &right[0]};
+        
+        double err = 0, peak = 0;
+        for (size_t b = 0; b < 16; b++) {
+            engine.process(out, 256);
+            for (size_t i = 0; i < 256; i++) {
+                size_t s = b * 256 + i;
+                double l = 0, r = 0;
+                for (size_t v = 0; v < monopoles.size(); v++) {
+                    if (s < begins[v] || s >= ends[v]) continue;
+                    double t = (double(s) - begins[v]) / SAMPLING_RATE;
+                    l += monopoles[v].pressure(t, ears[0]);
+                    r += monopoles[v].pressure(t, ears[1]);
+                }
+                err = std::max(err, std::max(fabs(l - left[i]), fabs(r - right[i])));
+                peak = std::max(peak, fabs(l));
+            }
+        }
+        assert(err < 1e-9 * peak);
+    }
+    
+    {
+        std::vector<Bubble *> bubbles;
+        RealtimeEngine engine(ears);
+        for (int b = 0; b < 200; b++) {
+            Vector3d loc(random_double(-1, 1), random_double(-1, 1), 0);
+            bubbles.push_back(new Bubble(random_double(2, 12), random_double(0, 1), loc));
+            bubbles.back()->set_depth(random_double(0.02, 0.1));
+            engine.addBubble(bubbles.back());
+        }
+        
+        engine.start();
+        NullSink sink(engine, false);
+        sink.run(SAMPLING_RATE);
+        engine.stop();
+        
+        RealtimeStats stats = engine.stats();
+        assert(stats.blocks == (SAMPLING_RATE + 255) / 256);
+        assert(stats.starved == 0);
+        assert(stats.droppedUpdates == 0 && stats.droppedVoices == 0);
+        
+        for (size_t b = 0; b < bubbles.size(); b++) {
+            delete bubbles[b];
+        }
+    }
+}
+
+// The oscillator bank should add up to the same thing as stepping
+// every oscillator on its own, however the output is split into blocks
+void test_oscillatorbank() {
+    
+    const size_t nsamples = 44100;
+    const double h = 1.0 / 44100.0;
+    
+    OscillatorBank bank(44100);
+    std::vector<double> expected(nsamples, 0.0);
+    std::vector<double> rendered(nsamples, 0.0);
+    
+    for (int i = 0; i < 500; i++) {
+        
+        size_t birth = rand() % nsamples;
+        size_t length = rand() % 5000;
+        double omega = 2 * M_PI * random_double(300, 3000);
+        double beta = random_double(5, 50);
+        double gain = random_double(0, 1);
+        
+        bank.addOscillator(birth, length, omega, beta, gain);
+        
+        DampedOscillatorStep step;
+        step.set(omega, beta, h);
+        double x = 0, v = -1;
+        for (size_t s = birth; s < birth + length && s < nsamples; s++) {
+            expected[s] += gain * x;
+            step.apply(x, v);
+        }
+    }
+    
+    for (size_t s = 0; s < nsamples; ) {
+        size_t n = std::min(nsamples - s, size_t(1 + rand() % 1000));
+        bank.render(&rendered[s], n);
+        s += n;
+    }
+    
+    for (size_t s = 0; s < nsamples; s++) {
+        assert(fabs(expected[s] - rendered[s]) < VERY_SMALL);
+    }
+}
+
+// A chain of filters run block by block over a track should give the
+// same samples as running each stage over the whole track in turn
+void test_filterchain() {
+    
+    const size_t nsamples = 5 * FILTER_BLOCK + 123;
+    
+    SoundTrack track(44100, 2);
+    std::vector<double> expected[2];
+    
+    for (int c = 0; c < 2; c++) {
+        expected[c].resize(nsamples);
+        for (size_t s = 0; s < nsamples; s++) {
+            expected[c][s] = random_double(-1, 1);
+        }
+        track.addSamples(&expected[c][0], nsamples, c);
+        
+        Gain gain(0.5);
+        SimplestLowpass lowpass;
+        Biquad biquad = Biquad::lowpass(1000, 44100);
+        gain.process(&expected[c][0], nsamples);
+        lowpass.process(&expected[c][0], nsamples);
+        biquad.process(&expected[c][0], nsamples);
+    }
+    
+    applyFilter(track, chain(Gain(0.5), SimplestLowpass(), Biquad::lowpass(1000, 44100)), 2);
+    
+    for (int c = 0; c < 2; c++) {
+        for (size_t s = 0; s < nsamples; s++) {
+            assert(fabs(expected[c][s] - track.sample(s, c)) < VERY_SMALL);
+        }
+    }
+}
+
+// The partitioned convolver should match direct convolution, tail
+// included, for IRs that are not a whole number of blocks long
+void test_convolver() {
+    
+    const size_t nsamples = 3000;
+    const size_t blockSize = 256;
+    const size_t irLengths[2] = {1000, 1500};
+    
+    std::vector<double> in(nsamples);
+    for (size_t s = 0; s < nsamples; s++) {
+        in[s] = random_double(-1, 1);
+    }
+    
+    std::vector<std::vector<double> > irs(2);
+    for (int c = 0; c < 2; c++) {
+        irs[c].resize(irLengths[c]);
+        for (size_t s = 0; s < irLengths[c]; s++) {
+            irs[c][s] = random_double(-1, 1) * exp(-0.005 * s);
+        }
+    }
+    
+    SoundTrack out(44100, 2);
+    convolveToListener(&in[0], nsamples, irs, out, blockSize);
+    
+    // the longest IR takes 6 partitions
+    assert(out.numSamples() == nsamples + 6 * blockSize - 1);
+    
+    for (int c = 0; c < 2; c++) {
+        assert(out.channelSize(c) == out.numSamples());
+        
+        for (size_t t = 0; t < out.numSamples(); t++) {
+            double expected = 0;
+            for (size_t k = 0; k < irs[c].size() && k <= t; k++) {
+                if (t - k < nsamples) {
+                    expected += irs[c][k] * in[t - k];
+                }
+            }
+            assert(fabs(expected - out.sample(t, c)) < VERY_SMALL);
+        }
+    }
+}
+
+// The timeline index should report exactly the intervals that overlap
+// each window
+void test_timelineindex() {
+    
+    std::vector<double> begins, ends;
+    TimelineIndex<double> timeline;
+    
+    for (int i = 0; i < 1000; i++) {
+        double b = random_double(0, 10);
+        double e = b + random_double(0, 0.2);
+        begins.push_back(b);
+        ends.push_back(e);
+        timeline.add(i, b, e);
+    }
+    timeline.build();
+    
+    std::vector<size_t> found;
+    for (int q = 0; q < 1000; q++) {
+        double t0 = random_double(-1, 11);
+        double t1 = t0 + random_double(0, 0.05);
+        timeline.querySorted(t0, t1, found);
+        
+        std::vector<size_t> expected;
+        for (size_t i = 0; i < begins.size(); i++) {
+            if (begins[i] <= t1 && ends[i] >= t0) expected.push_back(i);
+        }
+        assert(found == expected);
+    }
+}
+
 void make_bubbles(std::vector<Bubble *> &bubblevec, int nBubbles,
                   int mm_smallest, int mm_largest,
                   int sec_duration) {
@@ -132,6 +556,15 @@ int main(int argc, const char * argv[])
     
     
     test_sphericalbasis();
+    test_sphericalbatch();
+    test_multipole();
+    test_monopoleblock();
+    test_doppler();
+    test_realtime();
+    test_oscillatorbank();
+    test_filterchain();
+    test_convolver();
+    test_timelineindex();
     
     SoundTrack muzak;
     Timer simulation_timer;
@@ -164,36 +597,45 @@ int main(int argc, const char * argv[])
     cout << "Launching simulation..." << endl;
 
     
-    for (int i = 0; i < SAMPLING_RATE * total_duration; i++) {
+    // Index the bubbles' lifetimes (in samples), so that each block of
+    // samples only visits the bubbles that can be heard during it
+    TimelineIndex<double> timeline;
+    for (size_t b = 0; b < lotsa_bubbles.size(); b++) {
+        double birth = lotsa_bubbles[b]->get_birthtime();
+        timeline.add(b, birth * SAMPLING_RATE, (birth + Bubble::S_BUBBLELIFE) * SAMPLING_RATE);
+    }
+    timeline.build();
+    
+    const int blocksize = 256;
+    const int nsamples = SAMPLING_RATE * total_duration;
+    std::vector<size_t> audible;
+    
+    std::vector<Vector3d> ears;
+    ears.push_back(human.leftEar());
+    ears.push_back(human.rightEar());
+    
+    std::vector<double> left(blocksize), right(blocksize);
+    double *earpressures[2] = {&left[0], &right[0]};
+    
+    for (int i0 = 0; i0 < nsamples; i0 += blocksize) {
         
-        double t = i * timestep;
+        int i1 = std::min(i0 + blocksize, nsamples);
+        timeline.querySorted(i0, i1 - 1, audible);
         
-        double leftearpressure = 0.0;
-        double rightearpressure = 0.0;
+        std::fill(left.begin(), left.end(), 0.0);
+        std::fill(right.begin(), right.end(), 0.0);
         
         // add up the sound pressure from all the bubbles...
-        for (int b = 0; b < lotsa_bubbles.size(); b++) {
-            Bubble* curr_bubble = lotsa_bubbles[b];
-
-
-            bool isBubbleBorn = i >= curr_bubble->get_birthtime() * SAMPLING_RATE;
-            bool isBubbleDead = i > (curr_bubble->get_birthtime() + Bubble::S_BUBBLELIFE) * SAMPLING_RATE;
+        for (size_t a = 0; a < audible.size(); a++) {
+            Bubble* curr_bubble = lotsa_bubbles[audible[a]];
             
-            if(isBubbleBorn && !isBubbleDead) {
-	      
-	      curr_bubble->timestep(timestep);
-	      // 	      curr_bubble->set_depth( 0.023 - (t/0.15)*0.023 );
-	      std::cout << curr_bubble->depth()  << "   " << curr_bubble->frequency() << std::endl;
-	      leftearpressure += curr_bubble->pressure(t, human.leftEar());
-	      rightearpressure += curr_bubble->pressure(t, human.rightEar());
-            }
+            curr_bubble->renderBlock(i0 * timestep, timestep, i1 - i0, ears, earpressures);
+            std::cout << curr_bubble->depth()  << "   " << curr_bubble->frequency() << std::endl;
         }
         
         // insert the totals into the sound samples
-        muzak.addSample(leftearpressure, 0);
-        muzak.addSample(rightearpressure, 1);
-  
-       // movingthing.step(timestep);
+        muzak.addSamples(&left[0], i1 - i0, 0);
+        muzak.addSamples(&right[0], i1 - i0, 1);
     }
 
     //muzak.applyFilter(filter_simplest_lowpass);